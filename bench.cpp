@@ -0,0 +1,334 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/filesystem.hpp>
+#include "qcn.hpp"
+#include "report.hpp"
+#include "synth.hpp"
+
+using qcn::Qcn;
+namespace fs = boost::filesystem;
+
+// Stream buffer that discards what is written to it, counting the bytes
+
+class CountingBuffer : public std::streambuf
+{
+public:
+
+    CountingBuffer() : bytes_(0) {}
+    uint64_t const Bytes() const { return bytes_; }
+
+protected:
+
+    int_type overflow(int_type c)
+    {
+        bytes_++;
+        return c;
+    }
+
+    std::streamsize xsputn(char const*, std::streamsize n)
+    {
+        bytes_ += n;
+        return n;
+    }
+
+private:
+
+    uint64_t bytes_;
+};
+
+// Best time in seconds of repeat runs of f, which returns the bytes and 
+// items it processed. Results are printed one stage per line in fixed 
+// columns, so that runs can be compared line by line
+
+template <typename T_function>
+void Measure(
+    std::string const& stage, 
+    std::string const& input, 
+    qcn::uint const repeat, 
+    T_function f
+)
+{
+    double best = 0;
+    std::pair<uint64_t, uint64_t> n;
+
+    for (qcn::uint i = 0; i < repeat; i++)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        n = f();
+        std::chrono::duration<double> const t = 
+            std::chrono::steady_clock::now() - start;
+
+        if (i == 0 || t.count() < best) best = t.count();
+    }
+
+    double const s = best > 0 ? best : 1e-9;
+    std::printf(
+        "%-14s %-32s %12llu %9llu %10.6f %10.2f %12.0f\n",
+        stage.c_str(), 
+        input.c_str(), 
+        (unsigned long long)n.first, 
+        (unsigned long long)n.second, 
+        best, 
+        n.first / s / 1e6, 
+        n.second / s
+    );
+}
+
+// All the stages for a pair of files, the first being the baseline
+
+void Run(
+    std::string const& one, 
+    std::string const& two, 
+    std::string const& lookup, 
+    qcn::uint const repeat
+)
+{
+    std::string const nameone = fs::path(one).filename().string();
+    std::string const nametwo = fs::path(two).filename().string();
+    std::string const pair = nameone + ':' + nametwo;
+
+    uint64_t const bytes = fs::file_size(one) + fs::file_size(two);
+
+    std::unique_ptr<Qcn> lhs, rhs;
+
+    Measure("open", nameone, repeat, [&]() {
+        lhs.reset(new Qcn(one));
+        lhs->Open();
+        return std::make_pair(fs::file_size(one), uint64_t(lhs->Size()));
+    });
+    Measure("open", nametwo, repeat, [&]() {
+        rhs.reset(new Qcn(two));
+        rhs->Open();
+        return std::make_pair(fs::file_size(two), uint64_t(rhs->Size()));
+    });
+
+    if (!lhs->IsOpen() || !rhs->IsOpen())
+    {
+        std::cout << pair << ": " << (lhs->IsOpen() ? nametwo : nameone);
+        std::cout << ": " << (lhs->IsOpen() ? rhs : lhs)->ErrorMessage() << std::endl;
+        return;
+    }
+
+    uint64_t const items = lhs->Size() + rhs->Size();
+
+    // Each code of either file is looked up in the other, counting the 
+    // items found
+
+    Measure("find", pair, repeat, [&]() {
+        uint64_t found = 0;
+        for (auto i = lhs->Sorted().begin(); i != lhs->Sorted().end(); ++i)
+        {
+            found += rhs->Find((*i)->code) != rhs->end();
+        }
+        for (auto i = rhs->Sorted().begin(); i != rhs->Sorted().end(); ++i)
+        {
+            found += lhs->Find((*i)->code) != lhs->end();
+        }
+        return std::make_pair(bytes, found);
+    });
+    char const* const cmps[] = { "compare-p", "compare-m", "compare-b" };
+    Qcn::cmp const modes[] = { Qcn::cmp::present, Qcn::cmp::missing, Qcn::cmp::both };
+
+    for (int i = 0; i < 3; i++)
+    {
+        Measure(cmps[i], pair, repeat, [&]() {
+            auto const d = qcn::CompareRefs(*lhs, *rhs, modes[i]);
+            return std::make_pair(bytes, items);
+        });
+    }
+
+    // Printing is measured on all the differences, with descriptions
+
+    qcn::NvTable dict(lookup);
+    qcn::NvTable const* info = dict.Open() ? &dict : 0;
+    auto const d = qcn::CompareRefs(*lhs, *rhs, Qcn::cmp::both);
+
+    char const* const prints[] = { 
+        "print-i", "print-s", "print-d", "print-c", "print-j", "print-v" 
+    };
+    printformat const formats[] = { interleave, sequential, delta, count, json, csv };
+
+    for (int i = 0; i < 6; i++)
+    {
+        Measure(prints[i], pair, repeat, [&]() {
+            CountingBuffer buffer;
+            std::ostream o(&buffer);
+            {
+                qcn::ReportWriter w(o);
+                if (formats[i] == json || formats[i] == csv)
+                {
+                    for (auto j = d.begin(); j != d.end(); ++j)
+                    {
+                        PrintRecord(w, *j, nameone, nametwo, info, formats[i]);
+                    }
+                }
+                else
+                {
+                    PrintOutput(w, d, nameone, nametwo, info, formats[i]);
+                }
+            }
+            return std::make_pair(buffer.Bytes(), uint64_t(d.size()));
+        });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+
+    std::vector<std::string> files;
+    std::string lookup, table, dir;
+    qcn::uint repeat;
+    double active;
+    qcn::synth_options synth;
+
+    std::string prog(fs::path(argv[0]).filename().string());
+    std::string usage = "Usage: " + prog + " [options] [file file ...]";
+
+    po::options_description visible;
+    visible.add_options()
+        ("help,h", "show help message\n")
+        ("lookup,l", po::value<std::string>(&lookup)->default_value("nv.txt"),
+                        "nv item descriptions\n")
+        ("table,t", po::value<std::string>(&table)->default_value("nv.qnv"),
+                        "compiled descriptions, made from the lookup\n"
+                        "file if it does not exist\n")
+        ("repeat,r", po::value<qcn::uint>(&repeat)->default_value(5),
+                        "runs of each stage, the best of which is shown\n")
+        ("items,n", po::value<qcn::uint>(&synth.items)->default_value(65536),
+                        "items in the synthetic dumps, 0 for none\n")
+        ("size,s", po::value<qcn::uint>(&synth.size)->default_value(128),
+                        "payload size of the synthetic items\n")
+        ("active,a", po::value<double>(&active)->default_value(1.0),
+                        "fraction of synthetic items with data\n")
+        ("mutation,m", po::value<double>(&synth.mutation)->default_value(0.01),
+                        "fraction of items changed in the second dump\n")
+        ("dir,d", po::value<std::string>(&dir),
+                        "directory for the synthetic dumps, by default\n"
+                        "the temporary directory\n")
+    ;
+
+    po::options_description hidden("hidden options");
+    hidden.add_options()("input,i", po::value< std::vector<std::string> >(&files), "input file");
+
+    po::positional_options_description p;
+    p.add("input", -1);
+
+    po::options_description all;
+    all.add(visible).add(hidden);
+
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(all).positional(p).run(), vm
+    );
+    po::notify(vm);
+
+    if (vm.count("help") || files.size() % 2)
+    {
+        std::cout << std::endl << usage << std::endl << std::endl;
+        std::cout << "Files are compared in pairs" << std::endl << std::endl;
+        std::cout << visible;
+        return files.size() % 2;
+    }
+
+    // Items without data are spread evenly over the other statuses
+
+    synth.mix[0] = active;
+    synth.mix[1] = synth.mix[2] = synth.mix[3] = (1.0 - active) / 3;
+
+    std::printf("# qcnbench 1, best of %u\n", repeat);
+    std::printf(
+        "%-14s %-32s %12s %9s %10s %10s %12s\n",
+        "stage", "input", "bytes", "items", "seconds", "MB/s", "items/s"
+    );
+
+    // The dictionary is read from text, whatever it is named
+
+    Measure("dictionary", fs::path(lookup).filename().string(), repeat, [&]() {
+        qcn::Dictionary d(lookup);
+        d.Open();
+        return std::make_pair(
+            uint64_t(fs::exists(lookup) ? fs::file_size(lookup) : 0), 
+            uint64_t(d.Size())
+        );
+    });
+
+    // The compiled table is mapped as it is. Without one, the dictionary 
+    // is compiled into the temporary directory first, under a name of its
+    // own so that runs at the same time do not overwrite each other's files
+
+    bool const made = !fs::exists(table);
+    if (made)
+    {
+        qcn::NvTable d(lookup);
+        table = (fs::temp_directory_path() 
+            / fs::unique_path("qcnbench-%%%%-%%%%.qnv")).string();
+        if (!d.Open() || !d.Save(table)) table.clear();
+    }
+    if (!table.empty())
+    {
+        qcn::NvTable compiled(table);
+        uint64_t const entries = compiled.Open() ? compiled.Size() : 0;
+
+        Measure("nvtable", fs::path(table).filename().string(), repeat, [&]() {
+            qcn::NvTable t(table);
+            t.Open();
+            return std::make_pair(uint64_t(fs::file_size(table)), entries);
+        });
+
+        boost::system::error_code ec;
+        if (made) fs::remove(table, ec);
+    }
+
+    for (std::size_t i = 0; i < files.size(); i += 2)
+    {
+        Run(files[i], files[i + 1], lookup, repeat);
+    }
+
+    if (synth.items)
+    {
+        fs::path const base = dir.empty() ? fs::temp_directory_path() : fs::path(dir);
+        std::string const stem = fs::unique_path("qcnbench-%%%%-%%%%").string();
+        std::string const one = (base / (stem + "-a.txt")).string();
+        std::string const two = (base / (stem + "-b.txt")).string();
+        {
+            std::ofstream a(one, std::ios::binary), b(two, std::ios::binary);
+            Synthesize(a, synth);
+            synth.variant = 2;
+            Synthesize(b, synth);
+        }
+        Run(one, two, lookup, repeat);
+
+        boost::system::error_code ec;
+        fs::remove(one, ec);
+        fs::remove(two, ec);
+    }
+
+    std::printf("peak_rss_kb %llu\n", (unsigned long long)qcn::PeakRss());
+    return 0;
+}
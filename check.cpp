@@ -0,0 +1,1175 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+// Regression checks, run by make check over the files in testfiles and,
+// for the checks of the command line, the qcndiff program given after 
+// them. Each failure is printed on a line of its own, and the exit status
+// is the number of checks that failed
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+#include "qcn.hpp"
+#include "report.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+    int failed = 0;
+    fs::path scratch;
+
+    void Fail(std::string const& check, std::string const& what)
+    {
+        std::cout << "FAIL " << check << ": " << what << std::endl;
+        failed++;
+    }
+
+    // Regular files of the directory with the extension, in name order
+
+    std::vector<std::string> Files(
+        std::string const& directory,
+        std::string const& extension
+    )
+    {
+        std::vector<std::string> files;
+        for (fs::directory_iterator i(directory), end; i != end; ++i)
+        {
+            if (fs::is_regular_file(i->path())
+                && i->path().extension() == extension)
+            {
+                files.push_back(i->path().string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // Write a file into the scratch directory, returning its path
+
+    std::string const Scratch(std::string const& name, std::string const& text)
+    {
+        std::string const path = (scratch / name).string();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << text;
+        return path;
+    }
+
+    // Compress a file with gzip into the scratch directory, returning the
+    // path of the copy
+
+    std::string const Gzip(std::string const& filename, std::string const& name)
+    {
+        qcn::InputFile in(filename);
+        std::string const path = (scratch / name).string();
+
+        gzFile out = gzopen(path.c_str(), "wb");
+        if (!in.Open() || !out) return path;
+
+        gzwrite(out, in.begin(), unsigned(in.end() - in.begin()));
+        gzclose(out);
+        return path;
+    }
+
+    // Store a little endian value at an offset of a file image
+
+    void Put(
+        std::string& image, 
+        std::size_t const at, 
+        uint32_t const value, 
+        int const bytes = 4
+    )
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            image[at + i] = char((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // Output of a command run with the given standard input, and its 
+    // exit status
+
+    std::string const Run(
+        std::string const& command, 
+        std::string const& input, 
+        int& status
+    )
+    {
+        std::string const out = (scratch / "run.out").string();
+        status = std::system(
+            (command + " < \"" + input + "\" > \"" + out + "\" 2>&1").c_str()
+        );
+
+        std::ifstream in(out, std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(in), 
+            std::istreambuf_iterator<char>()
+        );
+    }
+
+    // Whether two loaded files hold the same items
+
+    bool const SameFiles(qcn::Qcn const& lhs, qcn::Qcn const& rhs)
+    {
+        qcn::Qcn::ordered_type const& l = lhs.Sorted();
+        qcn::Qcn::ordered_type const& r = rhs.Sorted();
+        if (l.size() != r.size()) return false;
+
+        for (std::size_t i = 0; i < l.size(); i++)
+        {
+            if (l[i]->code != r[i]->code
+                || l[i]->status != r[i]->status
+                || !(l[i]->data == r[i]->data))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The mask DiffBytes should make, one byte at a time
+
+    qcn::qcn_mask_type const ByteMask(
+        qcn::qcn_item_data_type const& lhs,
+        qcn::qcn_item_data_type const& rhs
+    )
+    {
+        qcn::uint const n = std::min(lhs.size(), rhs.size());
+        qcn::uint const size = std::max(lhs.size(), rhs.size());
+        qcn::qcn_mask_type mask((size + 63) / 64, 0);
+
+        for (qcn::uint i = 0; i < size; i++)
+        {
+            if (i >= n || lhs[i] != rhs[i]) mask[i / 64] |= 1ULL << (i % 64);
+        }
+        return mask;
+    }
+
+    // Whether the items the scanner made are those the grammar made, in
+    // the same order with the same statuses and payloads
+
+    bool const SameItems(
+        qcn::qcn_raw_items_type const& raw,
+        qcn::qcn_items_type const& items
+    )
+    {
+        if (raw.size() != items.size()) return false;
+
+        for (std::size_t i = 0; i < raw.size(); i++)
+        {
+            if (raw[i].code != items[i].code
+                || raw[i].status != qcn::StatusText(items[i].status)
+                || raw[i].data.size() != items[i].data.size()
+                || !std::equal(
+                        raw[i].data.begin(),
+                        raw[i].data.end(),
+                        items[i].data.begin()
+                    ))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+// Every text file is parsed by QcnScanner and by the grammar, which must
+// agree on whether the file is valid and, if it is, on every item
+
+void ScannerMatchesGrammar(std::string const& directory)
+{
+    std::vector<std::string> const files = Files(directory, ".txt");
+    if (files.empty()) Fail("scanner", "no test files in " + directory);
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        qcn::InputFile in(*i);
+        if (!in.Open())
+        {
+            Fail("scanner", *i + ": could not open");
+            continue;
+        }
+
+        qcn::qcn_raw_items_type raw;
+        char const* first = in.begin();
+        qcn::qcnparser<char const*> p;
+        bool const parsed = qcn::qi::phrase_parse(
+            first, in.end(), p >> qcn::qi::eoi, qcn::ascii::space, raw
+        ) && first == in.end();
+
+        qcn::qcn_arena_type arena;
+        qcn::qcn_items_type items;
+        qcn::QcnScanner s(in.begin(), in.end(), arena);
+        bool const scanned = s.Scan(items);
+
+        if (parsed != scanned)
+        {
+            Fail("scanner", *i + (parsed
+                ? ": rejected by the scanner only"
+                : ": rejected by the grammar only"));
+        }
+        else if (parsed && !SameItems(raw, items))
+        {
+            Fail("scanner", *i + ": items differ from the grammar's");
+        }
+    }
+}
+
+// Text fields of JSON and CSV records are escaped, whether they come from
+// the dictionary or the command line. A description cannot hold a quote,
+// which ends it in the dictionary, so the quote is in a file name instead
+
+void EscapedRecords()
+{
+    qcn::NvTable dict(Scratch("escape.txt", 
+        "5^\"Path\\to, band\"^\"Security*\"\n"));
+    if (!dict.Open())
+    {
+        Fail("escape", "could not load " + dict.ErrorMessage());
+        return;
+    }
+
+    qcn::qcn_item_type l, r;
+    l.code = r.code = 5;
+    l.status = qcn::status_inactive;
+    r.status = qcn::status_denied;
+
+    printformat const formats[] = { json, csv };
+    char const* const expected[] = {
+        "{\"base\":\"say \\\"hi\\\".txt\",\"file\":\"b.txt\",\"code\":5,"
+        "\"description\":\"Path\\\\to, band\",\"category\":\"Security\",",
+        "\"say \"\"hi\"\".txt\",b.txt,5,\"Path\\to, band\",Security,"
+    };
+
+    for (int i = 0; i < 2; i++)
+    {
+        std::ostringstream s;
+        {
+            qcn::ReportWriter o(s);
+            PrintRecord(o, qcn::qref(&l, &r), "say \"hi\".txt", "b.txt", 
+                &dict, formats[i]);
+        }
+        if (s.str().compare(0, std::strlen(expected[i]), expected[i]) != 0)
+        {
+            Fail("escape", "wrongly escaped record " + s.str());
+        }
+    }
+}
+
+// Codes past the dense part of a code table are kept apart from it, and 
+// are found, replaced and iterated over just as the codes below it are
+
+void SparseCodes()
+{
+    qcn::uint const codes[] = { 
+        3, 65535, 65536, 70000, 1 << 20, 4294967295u 
+    };
+    qcn::uint const absent[] = { 0, 4, 65534, 65537, 69999, 4294967294u };
+    qcn::CodeTable<qcn::uint> table;
+
+    for (auto code : codes) table[code] = code ^ 0x5A5A;
+    table[70000] = 7;
+
+    qcn::CodeTable<qcn::uint> const& t = table;
+    if (t.size() != 6 || t.bucket_count() > qcn::CodeTable<qcn::uint>::dense + 64)
+    {
+        Fail("codetable", "sparse codes grew the dense part");
+    }
+    for (auto code : codes)
+    {
+        auto const i = t.find(code);
+        qcn::uint const value = code == 70000 ? 7 : code ^ 0x5A5A;
+        if (i == t.end() || i->first != code || i->second != value)
+        {
+            Fail("codetable", "code " + std::to_string(code) + " not found");
+        }
+    }
+    for (auto code : absent)
+    {
+        if (t.find(code) != t.end())
+        {
+            Fail("codetable", "absent code " + std::to_string(code) + " found");
+        }
+    }
+
+    std::size_t n = 0;
+    for (auto i = t.begin(); i != t.end(); ++i, n++)
+    {
+        if (n >= 6 || i->first != codes[n]) break;
+    }
+    if (n != 6) Fail("codetable", "codes not iterated in insertion order");
+}
+
+// Codes far beyond those of real dictionaries are found in a compiled 
+// table, both in memory and as saved, without the table growing with them
+
+void LargeCodesCompile()
+{
+    std::string const text = 
+        "0^\"Zero\"^\"Security*\"\n"
+        "65535^\"Last dense\"^\"System*\"\n"
+        "200000000^\"Large\"^\"Security*\"\n"
+        "4294967295^\"Largest\"^\"System*\"\n";
+    qcn::uint const codes[] = { 0, 65535, 200000000, 4294967295u };
+    char const* const names[] = { "Zero", "Last dense", "Large", "Largest" };
+
+    qcn::NvTable dict(Scratch("large.txt", text));
+    if (!dict.Open() 
+        || !dict.Save((scratch / "large.qnv").string())
+        || !dict.Save((scratch / "large.qnv.ref").string()))
+    {
+        Fail("compile", "could not compile " + dict.ErrorMessage());
+        return;
+    }
+    if (fs::file_size(scratch / "large.qnv") > 65536 * 8 + 1024)
+    {
+        Fail("compile", "table grows with the largest code");
+    }
+
+    qcn::NvTable table((scratch / "large.qnv").string());
+    if (!table.Open()) Fail("compile", "could not load the saved table");
+
+    // A table saved over the file it was loaded from stays whole
+
+    qcn::NvTable resaved((scratch / "large.qnv").string());
+    if (!resaved.Open() || !resaved.Save((scratch / "large.qnv").string())
+        || fs::file_size(scratch / "large.qnv") 
+            != fs::file_size(scratch / "large.qnv.ref"))
+    {
+        Fail("compile", "table saved over itself is not whole");
+    }
+
+    qcn::NvTable const* const tables[] = { &dict, &table };
+    for (auto t : tables)
+    {
+        qcn::dict_entry e;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!t->Find(codes[i], e) || e.description != names[i])
+            {
+                Fail("compile", std::string("code not found: ") + names[i]);
+            }
+        }
+        if (t->Find(1, e) || t->Find(300000000, e))
+        {
+            Fail("compile", "found a code not in the dictionary");
+        }
+        std::vector<qcn::uint> const security = t->Codes("security");
+        if (security.size() != 2 || security[1] != 200000000)
+        {
+            Fail("compile", "category codes do not include large codes");
+        }
+    }
+}
+
+// Entries read only for the codes wanted, as for the descriptions of the
+// differing items, include codes up to the largest
+
+void LargeCodesLookup()
+{
+    std::string const text = 
+        "7^\"Small\"^\"System*\"\n"
+        "200000000^\"Large\"^\"Security*\"\n"
+        "4294967295^\"Largest\"^\"System*\"\n";
+    std::vector<qcn::uint> const codes = { 4294967295u, 8, 200000000, 7 };
+
+    qcn::NvTable dict(Scratch("lookup.txt", text));
+    if (!dict.Open(codes))
+    {
+        Fail("lookup", "could not read " + dict.ErrorMessage());
+        return;
+    }
+
+    qcn::dict_entry e;
+    if (!dict.Find(7, e) || e.description != "Small"
+        || !dict.Find(200000000, e) || e.description != "Large"
+        || !dict.Find(4294967295u, e) || e.description != "Largest")
+    {
+        Fail("lookup", "wanted code not read");
+    }
+    if (dict.Find(8, e)) Fail("lookup", "found a code not in the dictionary");
+}
+
+// Byte rules over overlapping codes clear the union of their bytes, and
+// the largest rules are read without their masks growing with the codes
+
+void IgnoreMasks()
+{
+    std::string const text =
+        "bytes 0-100 0-3   # bytes of both rules\n"
+        "bytes 50-200 8,64\n"
+        "code 7\n";
+
+    qcn::IgnoreRules rules;
+    if (!rules.Open(Scratch("overlap.rules", text)))
+    {
+        Fail("ignore", "could not read " + rules.ErrorMessage());
+        return;
+    }
+
+    struct { qcn::uint code; uint64_t first; uint64_t second; } 
+    const expected[] = {
+        { 10,  ~0xFULL,       ~0ULL }, 
+        { 60,  ~0x10FULL,     ~1ULL },
+        { 150, ~0x100ULL,     ~1ULL },
+        { 300, ~0ULL,         ~0ULL }
+    };
+    for (auto const& e : expected)
+    {
+        qcn::qcn_mask_type mask(2, ~0ULL);
+        rules.Apply(e.code, mask);
+        if (mask[0] != e.first || mask[1] != e.second)
+        {
+            Fail("ignore", "wrong bytes cleared for " + std::to_string(e.code));
+        }
+    }
+    if (!rules.Ignores(7) || rules.Ignores(8))
+    {
+        Fail("ignore", "wrong items ignored");
+    }
+
+    qcn::IgnoreRules all;
+    if (!all.Open(Scratch("all.rules", "bytes 0-65535 0-65535\n")))
+    {
+        Fail("ignore", "could not read " + all.ErrorMessage());
+    }
+    qcn::qcn_mask_type mask(4, ~0ULL);
+    if (all.Apply(65535, mask)) Fail("ignore", "bytes left in a cleared mask");
+
+    std::string many;
+    for (int i = 0; i < 100; i++)
+    {
+        many += "bytes " + std::to_string(i) + " 0-65535\n";
+    }
+    qcn::IgnoreRules wide;
+    if (wide.Open(Scratch("many.rules", many)))
+    {
+        Fail("ignore", "rules read past the bound on their masks");
+    }
+}
+
+// A compressed copy of each file, decompressed a block at a time as it is
+// parsed, loads the same items as the file. A truncated copy fails with 
+// the reason rather than as an invalid format
+
+void CompressedInput(std::string const& directory)
+{
+    std::vector<std::string> const files = Files(directory, ".txt");
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        std::string const name = fs::path(*i).filename().string();
+        qcn::Qcn text(*i);
+        qcn::Qcn gz(Gzip(*i, name + ".gz"));
+
+        if (text.Open() != gz.Open() || !SameFiles(text, gz))
+        {
+            Fail("compressed", name + ": items differ from the text's");
+        }
+    }
+
+    std::string const whole = Gzip(directory + "/906k.txt", "whole.gz");
+    qcn::InputFile in(whole, false);
+    if (!in.Open())
+    {
+        Fail("compressed", "could not open " + whole);
+        return;
+    }
+    Scratch("truncated.gz", std::string(in.begin(), in.begin() + 100000));
+
+    qcn::Qcn truncated((scratch / "truncated.gz").string());
+    if (truncated.Open() 
+        || truncated.ErrorMessage() != "Corrupt or truncated compressed input")
+    {
+        Fail("compressed", "truncated input: " + truncated.ErrorMessage());
+    }
+
+    qcn::NvTable dict((scratch / "truncated.gz").string());
+    if (dict.Open() 
+        || dict.ErrorMessage() != "Corrupt or truncated compressed input")
+    {
+        Fail("compressed", "truncated dictionary: " + dict.ErrorMessage());
+    }
+}
+
+// Each binary file, made from the text file named by the start of its name
+// with testfiles/mkqcn.py, holds the OK items of 128 bytes of that file
+
+void BinaryFiles(std::string const& directory)
+{
+    std::vector<std::string> const files = Files(directory, ".qcn");
+    if (files.empty()) Fail("binary", "no binary test files in " + directory);
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        std::string const name = fs::path(*i).filename().string();
+        std::string const source = 
+            directory + "/" + name.substr(0, name.find('.')) + ".txt";
+
+        qcn::Qcn binary(*i);
+        qcn::Qcn text(source);
+        if (!binary.Open() || !text.Open())
+        {
+            Fail("binary", name + ": could not load " + binary.ErrorMessage());
+            continue;
+        }
+
+        std::vector<qcn::qcn_item_type const*> expected;
+        for (auto j = text.Sorted().begin(); j != text.Sorted().end(); ++j)
+        {
+            if ((*j)->status == qcn::status_ok && (*j)->data.size() == 128)
+            {
+                expected.push_back(*j);
+            }
+        }
+
+        qcn::Qcn::ordered_type const& items = binary.Sorted();
+        bool same = items.size() == expected.size();
+        for (std::size_t j = 0; same && j < items.size(); j++)
+        {
+            same = items[j]->code == expected[j]->code
+                && items[j]->status == qcn::status_ok
+                && items[j]->data == expected[j]->data;
+        }
+        if (!same) Fail("binary", name + ": items differ from " + source);
+    }
+}
+
+// Compound documents whose header points outside the file, or whose DIFAT
+// chain loops, are rejected rather than read out of bounds or without end
+
+void MalformedBinary()
+{
+    std::string const magic("\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", 8);
+
+    // 4096 byte sectors in a file too short to hold one
+
+    std::string shorter(1024, '\0');
+    shorter.replace(0, 8, magic);
+    Put(shorter, 0x1E, 12, 2);
+    Put(shorter, 0x20, 6, 2);
+    Put(shorter, 0x2C, 1);
+    Put(shorter, 0x4C, 100000);
+
+    // More FAT sectors than the header lists, the rest in a DIFAT sector
+    // that links to itself
+
+    std::string looped(301 * 512, '\0');
+    looped.replace(0, 8, magic);
+    Put(looped, 0x1E, 9, 2);
+    Put(looped, 0x20, 6, 2);
+    Put(looped, 0x2C, 290);
+    Put(looped, 0x44, 1);
+    Put(looped, 0x48, 0xFFFFFFFF);
+    Put(looped, 2 * 512 + 508, 1);
+
+    std::string const* const images[] = { &shorter, &looped };
+    for (auto image : images)
+    {
+        qcn::Qcn q(Scratch("malformed.qcn", *image));
+        if (q.Open() 
+            || q.ErrorMessage() != "Invalid compound document in binary file")
+        {
+            Fail("malformed", "read a malformed compound document");
+        }
+    }
+}
+
+// A stream of items that is not a whole number of records, as of another
+// layout, is reported with its size
+
+void BinaryRecordSize(std::string const& directory)
+{
+    qcn::InputFile in(directory + "/tst1.qcn");
+    if (!in.Open())
+    {
+        Fail("records", "could not open tst1.qcn");
+        return;
+    }
+
+    // The directory entry of the stream is found by its name, ended by a
+    // zero character, and given a size one short of whole records
+
+    std::string image(in.begin(), in.end());
+    std::string name;
+    for (char const* c = "NV_ITEM_ARRAY"; *c; c++)
+    {
+        name += std::string(1, *c) + '\0';
+    }
+    name += std::string(2, '\0');
+
+    std::size_t const at = image.find(name);
+    if (at == std::string::npos || at % 128 != 0)
+    {
+        Fail("records", "no NV_ITEM_ARRAY entry in tst1.qcn");
+        return;
+    }
+    Put(image, at + 0x78, 4 * 132 - 1);
+
+    qcn::Qcn q(Scratch("records.qcn", image));
+    if (q.Open() 
+        || q.ErrorMessage() 
+            != "NV_ITEM_ARRAY of 527 bytes is not made of 132 byte records")
+    {
+        Fail("records", "wrong record size not reported: " + q.ErrorMessage());
+    }
+}
+
+// Files large enough to be split into chunks parsed on several threads
+// load the same items as when parsed serially
+
+void ChunkedParse(std::string const& directory)
+{
+    std::vector<std::string> const files = Files(directory, ".txt");
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        qcn::Qcn serial(*i);
+        bool const opened = serial.Open();
+
+        for (qcn::uint threads = 2; threads <= 8; threads *= 2)
+        {
+            qcn::Qcn chunked(*i);
+            chunked.SetThreads(threads);
+
+            if (chunked.Open() != opened || !SameFiles(serial, chunked))
+            {
+                Fail("chunks", *i + ": items differ on " 
+                    + std::to_string(threads) + " threads");
+            }
+        }
+    }
+}
+
+// The sizes of the items of testfiles/sections.txt follow its headers: a 
+// fixed size, a length given with the item, a label that leaves the size
+// as it was, and a section of variable size
+
+void SectionSizes(std::string const& directory)
+{
+    qcn::uint const sizes[] = { 16, 0, 4, 3, 4, 5, 0, 2, 0, 128, 0 };
+    qcn::Qcn q(directory + "/sections.txt");
+
+    if (!q.Open() || q.Sorted().size() != 11)
+    {
+        Fail("sections", "could not load sections.txt " + q.ErrorMessage());
+        return;
+    }
+    for (std::size_t i = 0; i < 11; i++)
+    {
+        qcn::qcn_item_type const& item = *q.Sorted()[i];
+        if (item.code != i + 1 || item.data.size() != sizes[i])
+        {
+            Fail("sections", "wrong size of item " + std::to_string(i + 1));
+        }
+    }
+}
+
+// A file of many large sections of different item sizes parses the same
+// with the grammar, serially, in chunks and as it is decompressed, each 
+// way carrying the section of one part of the file over to the next
+
+void SectionsAcrossParts()
+{
+    std::string text = "[NV items]\r\n";
+    char const* const headers[] = { "128", "16", "variable", "32" };
+    qcn::uint const sizes[] = { 128, 16, 61, 32 };
+    qcn::uint code = 0;
+    char line[64];
+
+    for (int section = 0; section < 12; section++)
+    {
+        text += std::string("[Complete items - 4000, Items size - ")
+            + headers[section % 4] + "]\r\n\r\n";
+
+        for (int i = 0; i < 4000; i++, code++)
+        {
+            // Every third item gives its length, one short of the size
+
+            bool const sized = code % 3 == 0;
+            qcn::uint const size = sizes[section % 4] - sized;
+
+            std::sprintf(line, "%05u (0x%04X)   -   OK", code, code);
+            text += line;
+            text += sized ? " - " + std::to_string(size) + "\r\n" : "\r\n";
+
+            for (qcn::uint j = 0; j < size; j++)
+            {
+                std::sprintf(line, j % 16 == 15 || j + 1 == size 
+                    ? "%02X\r\n" : "%02X ", (code * 31 + j * 7) & 0xFF);
+                text += line;
+            }
+            text += "\r\n";
+        }
+    }
+
+    std::string const path = Scratch("sections.txt", text);
+
+    qcn::qcn_raw_items_type raw;
+    char const* first = text.data();
+    char const* const last = text.data() + text.size();
+    qcn::qcnparser<char const*> p;
+    qcn::qcn_arena_type arena;
+    qcn::qcn_items_type items;
+    qcn::QcnScanner s(text.data(), last, arena);
+
+    bool const parsed = qcn::qi::phrase_parse(
+        first, last, p >> qcn::qi::eoi, qcn::ascii::space, raw
+    );
+    if (!parsed || !s.Scan(items) || !SameItems(raw, items))
+    {
+        Fail("sections", "scanner and grammar differ across sections");
+    }
+
+    qcn::Qcn serial(path);
+    qcn::Qcn chunked(path);
+    qcn::Qcn streamed(Gzip(path, "sections.txt.gz"));
+    chunked.SetThreads(4);
+
+    if (!serial.Open() || serial.Sorted().size() != code)
+    {
+        Fail("sections", "could not load every item " + serial.ErrorMessage());
+    }
+    if (!chunked.Open() || !SameFiles(serial, chunked))
+    {
+        Fail("sections", "chunks differ from the serial parse");
+    }
+    if (!streamed.Open() || !SameFiles(serial, streamed))
+    {
+        Fail("sections", "decompressed parse differs from the serial parse");
+    }
+}
+
+// The mask of differing bytes is the same whether the bytes are compared
+// sixteen at a time or one at a time, for payloads of whole and part 
+// blocks, at unaligned offsets and of unequal lengths
+
+void DiffMasks()
+{
+    qcn::uint const sizes[][2] = { 
+        {0, 0}, {16, 16}, {32, 32}, {37, 37}, {128, 128}, {130, 130},
+        {37, 20}, {0, 5}, {17, 0}, {100, 130}, {64, 65}
+    };
+    qcn::qcn_arena_type arena(1024);
+
+    for (auto const& s : sizes)
+    {
+        for (int pattern = 0; pattern < 4; pattern++)
+        {
+            // Offset by one byte so that no payload starts aligned
+
+            qcn::qcn_item_data_type const lhs(&arena, 1, s[0]);
+            qcn::qcn_item_data_type const rhs(&arena, 513, s[1]);
+
+            for (qcn::uint i = 0; i < 512; i++)
+            {
+                arena[1 + i] = uint8_t(i * 13);
+                bool const differs = pattern == 1 ? i % 7 == 3
+                    : pattern == 2 ? i == 15 || i == 16 || i == 36 || i == 127
+                    : pattern == 3;
+                arena[513 + i] = uint8_t(i * 13 + differs);
+            }
+
+            qcn::qcn_mask_type got;
+            bool const any = qcn::DiffBytes(lhs, rhs, got);
+            qcn::qcn_mask_type const expected = ByteMask(lhs, rhs);
+
+            bool const expected_any = std::find_if(
+                expected.begin(), 
+                expected.end(), 
+                [](uint64_t const w) { return w != 0; }
+            ) != expected.end();
+
+            if (got != expected || any != expected_any)
+            {
+                Fail("diff", "wrong mask for payloads of " 
+                    + std::to_string(s[0]) + " and " + std::to_string(s[1]) 
+                    + " bytes, pattern " + std::to_string(pattern));
+            }
+        }
+    }
+}
+
+// A file of items of every status, with and without payloads, some of 
+// them missing, for comparison with another made with a different seed
+
+std::string const CompareText(qcn::uint const seed)
+{
+    char const* const statuses[] = { 
+        "Inactive item", "Parameter bad", "Access denied" 
+    };
+    std::string text = "[NV items]\n[Complete items - 400, Items size - 128]\n\n";
+    char line[64];
+
+    for (qcn::uint code = 0; code < 400; code++)
+    {
+        if ((code * seed) % 11 == 5) continue;
+
+        // Items without a payload differ by status alone
+
+        if (code % 4 == 0)
+        {
+            std::sprintf(line, "%05u (0x%04X)   -   %s\n\n", 
+                code, code, statuses[(code / 4 + seed * (code % 3)) % 3]);
+            text += line;
+            continue;
+        }
+
+        std::sprintf(line, "%05u (0x%04X)   -   OK\n", code, code);
+        text += line;
+
+        for (qcn::uint j = 0; j < 128; j++)
+        {
+            bool const differs = code % 5 == 0 && j == (code * seed) % 128;
+            std::sprintf(line, j % 16 == 15 ? "%02X\n" : "%02X ", 
+                (code + j + differs) & 0xFF);
+            text += line;
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+// The merge join finds the same differences, in code order, as looking 
+// up each code of either file in a hash table of the other, for each 
+// kind of comparison, and Compare copies out what CompareRefs refers to
+
+void MergeMatchesLookup()
+{
+    qcn::Qcn lhs(Scratch("compare-a.txt", CompareText(1)));
+    qcn::Qcn rhs(Scratch("compare-b.txt", CompareText(2)));
+
+    if (!lhs.Open() || !rhs.Open())
+    {
+        Fail("merge", "could not load " + lhs.ErrorMessage() + rhs.ErrorMessage());
+        return;
+    }
+
+    std::unordered_map<qcn::uint, qcn::qcn_item_type const*> left, right;
+    std::set<qcn::uint> codes;
+    for (auto i : lhs.Sorted()) { left[i->code] = i; codes.insert(i->code); }
+    for (auto i : rhs.Sorted()) { right[i->code] = i; codes.insert(i->code); }
+
+    qcn::Qcn::cmp const cmps[] = { 
+        qcn::Qcn::cmp::present, qcn::Qcn::cmp::missing, qcn::Qcn::cmp::both 
+    };
+    bool sided = false, status = false;
+
+    for (auto cmp : cmps)
+    {
+        qcn::diff_ref_type expected;
+
+        for (auto code : codes)
+        {
+            auto const l = left.find(code);
+            auto const r = right.find(code);
+
+            if (l == left.end() || r == right.end())
+            {
+                if (cmp == qcn::Qcn::cmp::present) continue;
+                expected.push_back(qcn::qref(
+                    l != left.end() ? l->second : 0, 
+                    r != right.end() ? r->second : 0
+                ));
+                sided = true;
+            }
+            else if (cmp != qcn::Qcn::cmp::missing
+                && (l->second->status != r->second->status
+                    || l->second->data != r->second->data))
+            {
+                expected.push_back(qcn::qref(l->second, r->second, 
+                    ByteMask(l->second->data, r->second->data)));
+                status |= l->second->data == r->second->data;
+            }
+        }
+
+        qcn::diff_ref_type const got = qcn::CompareRefs(lhs, rhs, cmp);
+        qcn::diff_type const copied = qcn::Compare(lhs, rhs, cmp);
+        std::string const kind = std::to_string(int(cmp));
+
+        if (got.size() != expected.size() || copied.size() != expected.size())
+        {
+            Fail("merge", "wrong number of differences for comparison " + kind);
+            continue;
+        }
+
+        for (std::size_t i = 0; i < got.size(); i++)
+        {
+            if (got[i].lhs != expected[i].lhs
+                || got[i].rhs != expected[i].rhs
+                || got[i].missing != expected[i].missing
+                || got[i].mask != expected[i].mask)
+            {
+                Fail("merge", "difference in code " 
+                    + std::to_string(expected[i].Code()) 
+                    + " not found for comparison " + kind);
+                break;
+            }
+
+            qcn::qdiff const& c = copied[i];
+            qcn::qcn_item_type const& l = expected[i].Left();
+            qcn::qcn_item_type const& r = expected[i].Right();
+
+            if (c.first.code != l.code || c.first.status != l.status
+                || c.second.code != r.code || c.second.status != r.status
+                || !(c.first.data == l.data) || !(c.second.data == r.data)
+                || c.mask != expected[i].mask)
+            {
+                Fail("merge", "Compare copied code " 
+                    + std::to_string(expected[i].Code()) + " wrongly");
+                break;
+            }
+        }
+    }
+
+    if (!sided || !status)
+    {
+        Fail("merge", "compared files lack one sided or status differences");
+    }
+}
+
+// Items passed over by a filter as each file is parsed, whether serially,
+// in chunks, as it is decompressed or from the cache, leave exactly the 
+// items of the whole file that the filter accepts
+
+void FilteredParse(std::string const& directory)
+{
+    qcn::CodeFilter filter;
+    filter.Add("2-4,7,10,100-999,6828,20000-30000,40000-65535");
+
+    std::vector<std::string> const files = Files(directory, ".txt");
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        std::string const name = fs::path(*i).filename().string();
+        qcn::Qcn whole(*i);
+        if (!whole.Open()) continue;
+
+        std::vector<qcn::qcn_item_type const*> expected;
+        for (auto j = whole.Sorted().begin(); j != whole.Sorted().end(); ++j)
+        {
+            if (filter.Accepts((*j)->code)) expected.push_back(*j);
+        }
+
+        std::string const copy = (scratch / name).string();
+        fs::copy_file(*i, copy, fs::copy_option::overwrite_if_exists);
+        qcn::Qcn cached(copy);
+        cached.SetCache(true);
+        cached.Open();
+
+        char const* const ways[] = { "serial", "chunks", "stream", "cache" };
+        for (int way = 0; way < 4; way++)
+        {
+            qcn::Qcn q(way == 2 ? Gzip(*i, name + ".gz") : way == 3 ? copy : *i);
+            q.SetFilter(&filter);
+            q.SetThreads(way == 1 ? 4 : 1);
+            q.SetCache(way == 3);
+
+            bool same = q.Open() && q.Sorted().size() == expected.size();
+            for (std::size_t j = 0; same && j < expected.size(); j++)
+            {
+                same = q.Sorted()[j]->code == expected[j]->code
+                    && q.Sorted()[j]->status == expected[j]->status
+                    && q.Sorted()[j]->data == expected[j]->data;
+            }
+            if (!same)
+            {
+                Fail("filter", name + ": filtered items differ, " + ways[way]);
+            }
+        }
+    }
+}
+
+// Loading a copy of a file, here after the file has changed, leaves the 
+// payloads of the original as they were
+
+void ReloadedCopy(std::string const& directory)
+{
+    std::ifstream first(directory + "/tst1.txt", std::ios::binary);
+    std::ifstream second(directory + "/tst2.txt", std::ios::binary);
+    std::string const path = Scratch("copied.txt", std::string(
+        std::istreambuf_iterator<char>(first), std::istreambuf_iterator<char>()
+    ));
+
+    qcn::Qcn original(path);
+    qcn::Qcn expected(directory + "/tst1.txt");
+    if (!original.Open() || !expected.Open())
+    {
+        Fail("copy", "could not load " + path);
+        return;
+    }
+
+    qcn::Qcn copy(original);
+    Scratch("copied.txt", std::string(
+        std::istreambuf_iterator<char>(second), std::istreambuf_iterator<char>()
+    ));
+    if (!copy.Open() || !SameFiles(original, expected))
+    {
+        Fail("copy", "loading a copy changed the original");
+    }
+}
+
+// The cached index of a file is not used once the file has changed size 
+// or been written since, and is saved again for the file as it now is
+
+void StaleIndex(std::string const& directory)
+{
+    auto contents = [](std::string const& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(in), 
+            std::istreambuf_iterator<char>()
+        );
+    };
+
+    std::string const first = contents(directory + "/tst1.txt");
+    std::string const second = contents(directory + "/tst2.txt") + "\r\n";
+    std::string const path = Scratch("stale.txt", first);
+    std::string const index = path + ".qcnidx";
+    std::time_t const written = fs::last_write_time(path);
+
+    qcn::Qcn original(path);
+    original.SetCache(true);
+    if (!original.Open() || !fs::exists(index))
+    {
+        Fail("index", "no index saved for " + path);
+        return;
+    }
+    std::string const saved = contents(index);
+
+    qcn::Qcn resized(directory + "/tst2.txt");
+    qcn::Qcn rewritten(directory + "/tst1.txt");
+    qcn::Qcn* const expected[] = { &resized, &rewritten };
+    char const* const changes[] = { "size", "time" };
+
+    for (int change = 0; change < 2; change++)
+    {
+        // Put the index of the original file back beside the changed one
+
+        Scratch("stale.txt", change == 0 ? second : first);
+        fs::last_write_time(path, change == 0 ? written : written + 10);
+        Scratch("stale.txt.qcnidx", saved);
+
+        qcn::Qcn q(path);
+        q.SetCache(true);
+        if (!q.Open() || !expected[change]->Open() 
+            || !SameFiles(q, *expected[change]) || contents(index) == saved)
+        {
+            Fail("index", std::string("index used after a change of ") 
+                + changes[change]);
+        }
+    }
+}
+
+// stdin compared with --stream against a file that cannot be streamed is
+// compared as when loaded, though the other file is read first
+
+void StreamStdin(std::string const& directory, std::string const& program)
+{
+    std::string const unordered = Scratch("unordered.txt",
+        "[NV items]\r\n[Complete items - 2, Items size - 4]\r\n\r\n"
+        "00002 (0x0002)   -   OK\r\n01 02 03 04\r\n\r\n"
+        "00001 (0x0001)   -   OK\r\n05 06 07 08\r\n\r\n"
+    );
+    std::string const input = directory + "/tst1.txt";
+    std::string const files = " -t b -f c - \"" + unordered + "\"";
+
+    int loaded, streamed;
+    std::string const expected = Run(program + files, input, loaded);
+    std::string const got = Run(program + " --stream" + files, input, streamed);
+
+    if (loaded != 0 || streamed != 0 || got != expected)
+    {
+        Fail("stdin", "streamed stdin differs from loaded: " + got);
+    }
+}
+
+// A category that names no items, for the filter or in ignore rules, is 
+// an error rather than a comparison of nothing
+
+void UnknownCategory(std::string const& directory, std::string const& program)
+{
+    std::string const files = " -l \"" + directory + "/../nv.txt\" \"" 
+        + directory + "/tst1.txt\" \"" + directory + "/tst2.txt\"";
+    std::string const rules = Scratch("category.rules", "category nosuchthing\n");
+
+    std::string const options[] = { 
+        " --category nosuchthing", " --ignore \"" + rules + "\"" 
+    };
+    for (auto const& o : options)
+    {
+        int status;
+        std::string const got = Run(program + o + files, rules, status);
+
+        if (status == 0 
+            || got.find("No items in category nosuchthing") == std::string::npos)
+        {
+            Fail("category", "unknown category accepted: " + got);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string const directory = argc > 1 ? argv[1] : "testfiles";
+    std::string const program = argc > 2 ? argv[2] : "";
+
+    scratch = fs::temp_directory_path() / fs::unique_path("qcncheck-%%%%-%%%%");
+    fs::create_directories(scratch);
+
+    ScannerMatchesGrammar(directory);
+    ChunkedParse(directory);
+    SectionSizes(directory);
+    SectionsAcrossParts();
+    FilteredParse(directory);
+    StaleIndex(directory);
+    ReloadedCopy(directory);
+    DiffMasks();
+    MergeMatchesLookup();
+    if (!program.empty())
+    {
+        StreamStdin(directory, program);
+        UnknownCategory(directory, program);
+    }
+    SparseCodes();
+    EscapedRecords();
+    LargeCodesCompile();
+    LargeCodesLookup();
+    IgnoreMasks();
+    CompressedInput(directory);
+    BinaryFiles(directory);
+    MalformedBinary();
+    BinaryRecordSize(directory);
+
+    boost::system::error_code ec;
+    fs::remove_all(scratch, ec);
+
+    std::cout << (failed ? "checks failed" : "checks passed") << std::endl;
+    return failed;
+}
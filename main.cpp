@@ -18,35 +18,114 @@ Copyright 2014 dl12345@xda-developers forum
 
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
 #include <boost/filesystem.hpp>
 #include "qcn.hpp"
+#include "report.hpp"
 
 using qcn::Qcn;
 namespace fs = boost::filesystem;
-typedef enum {interleave, sequential, count} printformat;
+typedef std::vector< std::unique_ptr<qcn::QcnStream> > streams_type;
+
+// Allocations are counted for --stats only. Without it, the counting
+// costs each allocation no more than one untaken branch
+
+namespace
+{
+    std::atomic<bool> counting(false);
+    std::atomic<uint64_t> allocations(0);
+    std::atomic<uint64_t> allocated(0);
+}
+
+void* operator new(std::size_t n)
+{
+    if (counting.load(std::memory_order_relaxed))
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocated.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+// Prints the statistics of a run to stderr when it goes out of scope, 
+// however main returns. The total CPU time is that of all the threads
+
+class StatsReport
+{
+public:
+
+    StatsReport(run_stats* stats, bool const json)
+        :   stats_(stats),
+            json_(json),
+            wall_(stats ? qcn::StageTimer::Wall() : 0),
+            cpu_(stats ? qcn::StageTimer::ProcessCpu() : 0)
+    {
+        counting = stats_ != 0;
+    }
+
+    ~StatsReport()
+    {
+        if (!stats_) return;
+
+        stats_->total.wall = qcn::StageTimer::Wall() - wall_;
+        stats_->total.cpu = qcn::StageTimer::ProcessCpu() - cpu_;
+        counting = false;
+        stats_->allocations = allocations;
+        stats_->allocated = allocated;
+        PrintStats(std::cerr, *stats_, json_);
+    }
+
+private:
+
+    run_stats* stats_;
+    bool const json_;
+    double const wall_;
+    double const cpu_;
+};
 
 bool const ProcessCommandLine(
     int ac, 
     char *av[], 
     Qcn::cmp& cmp,
     printformat& format, 
-    std::string& fileone,
-    std::string& filetwo,
-    std::string& filedict
+    files_type& files,
+    std::string& filedict,
+    qcn::uint& jobs,
+    bool& cache,
+    std::string& compile,
+    bool& stream,
+    bool& stats,
+    bool& statsjson,
+    qcn::CodeFilter& filter,
+    files_type& categories,
+    std::string& rules
 )
 {
     namespace po = boost::program_options;
-    typedef std::vector<std::string> files_type;
 
     char t, pf;
-    files_type f;
+    files_type f, codes;
     
     std::string prog(fs::path(av[0]).filename().string());
-    std::string usage = "Usage: " + prog + " [options] file file";
+    std::string usage = "Usage: " + prog + " [options] file file [file ...]";
 
     po::options_description visible;
     visible.add_options()
@@ -60,9 +139,41 @@ bool const ProcessCommandLine(
                         "output format\n"
                         "    i for interleaved output\n"
                         "    s for sequential output\n"
-                        "    c to suppress item data and print only count\n")
+                        "    d for differing bytes only\n"
+                        "    c to suppress item data and print only count\n"
+                        "    j for one JSON record per line for each item\n"
+                        "    v for one CSV record for each item\n")
         ("lookup,l", po::value<std::string>(&filedict)->default_value("nv.txt"),
-                        "nv item descriptions")
+                        "nv item descriptions, as text or as a table\n"
+                        "made with --compile. nv.qnv is used in\n"
+                        "place of the default if it is up to date\n")
+        ("jobs,j", po::value<qcn::uint>(&jobs)->default_value(0),
+                        "number of files to load in parallel\n"
+                        "    0 for one per processor\n")
+        ("cache,c", po::bool_switch(&cache),
+                        "keep parsed files in file.qcnidx for faster "
+                        "reloading\n")
+        ("codes", po::value<files_type>(&codes),
+                        "compare only the items with these codes, as\n"
+                        "in 1000-2000,6828. May be repeated\n")
+        ("category", po::value<files_type>(&categories),
+                        "compare only the items in this category of the\n"
+                        "nv item descriptions, or in those starting\n"
+                        "with it. May be repeated\n")
+        ("ignore", po::value<std::string>(&rules),
+                        "leave out the differences named by the rules\n"
+                        "in this file\n")
+        ("stream", po::bool_switch(&stream),
+                        "compare files item by item as they are read,\n"
+                        "without loading them, for formats c, j and v\n")
+        ("stats", po::bool_switch(&stats),
+                        "print the time and memory taken by each stage\n"
+                        "to stderr\n")
+        ("stats-json", po::bool_switch(&statsjson),
+                        "as --stats, as a JSON object\n")
+        ("compile", po::value<std::string>(&compile),
+                        "compile the nv item descriptions into a table\n"
+                        "file and exit")
     ;
 
     po::options_description hidden("hidden options");
@@ -87,24 +198,50 @@ bool const ProcessCommandLine(
         return false;
     }
 
-    // process and set input files
+    // A compiled dictionary is preferred to the default text one unless 
+    // the text has changed since it was compiled, or it does not load. 
+    // The text is always the one compiled
 
-    if (vm.count("input") && f.size() == 2)
+    if (vm["lookup"].defaulted() 
+        && !vm.count("compile") 
+        && fs::exists("nv.qnv"))
     {
-        fileone = f[0];
-        filetwo = f[1];
+        boost::system::error_code ec;
+        qcn::NvTable table("nv.qnv");
 
-        if (!fs::exists(fileone))
+        if ((!fs::exists(filedict) 
+                || fs::last_write_time("nv.qnv", ec) 
+                    >= fs::last_write_time(filedict, ec))
+            && table.Open())
         {
-            std::cout << prog << ": " << fileone << " not found" << std::endl;
-            return false;
+            filedict = "nv.qnv";
         }
+    }
+
+    // process and set input files
+
+    if (vm.count("compile"))
+    {
+        return true;
+    }
+    else if (vm.count("input") && f.size() >= 2)
+    {
+        // stdin can be read only once
 
-        if (!fs::exists(filetwo))
+        if (std::count(f.begin(), f.end(), std::string("-")) > 1)
         {
-            std::cout << prog << ": " << filetwo << " not found" << std::endl;
+            std::cout << prog << ": - may be given only once" << std::endl;
             return false;
         }
+        for (auto i = f.begin(); i != f.end(); ++i)
+        {
+            if (*i != "-" && !fs::exists(*i))
+            {
+                std::cout << prog << ": " << *i << " not found" << std::endl;
+                return false;
+            }
+        }
+        files = f;
     }
     else
     {
@@ -113,6 +250,17 @@ bool const ProcessCommandLine(
         return false;
     }
 
+    // process code ranges
+
+    for (auto i = codes.begin(); i != codes.end(); ++i)
+    {
+        if (!filter.Add(*i))
+        {
+            std::cout << prog << ": invalid code ranges " << *i << std::endl;
+            return false;
+        }
+    }
+
     // process and set comparison type
 
     if (vm.count("type"))
@@ -147,9 +295,18 @@ bool const ProcessCommandLine(
             case 's':
                 format = sequential;
                 break;
+            case 'd':
+                format = delta;
+                break;
             case 'c':
                 format = count;
                 break;
+            case 'j':
+                format = json;
+                break;
+            case 'v':
+                format = csv;
+                break;
             default:
                 std::cout << std::endl << usage << std::endl << std::endl;
                 std::cout << visible;
@@ -160,109 +317,418 @@ bool const ProcessCommandLine(
     return true;
 }
 
-void PrintOutput(
-    qcn::diff_type const& d, 
-    std::string const& fileone,
-    std::string const& filetwo,
-    std::string const& filedict,
-    printformat p = interleave
+// Pass the codes of a category to add as runs of consecutive codes. 
+// Returns false if the category has no codes, most likely a misspelling
+
+template <typename T_add>
+bool const AddCategory(
+    qcn::NvTable const& table, 
+    std::string const& category, 
+    T_add add
 )
 {
-    std::cout << std::endl;
-    std::cout << "Found " << d.size() << " non matching items";
-    std::cout << std::endl << std::endl;
-    
-    qcn::Dictionary dict(filedict);
-    bool printinfo = false;      
-    if (dict.Open()) printinfo = true;
+    std::vector<qcn::uint> const codes = table.Codes(category);
+    for (std::size_t j = 0, k = 0; j < codes.size(); j = k)
+    {
+        for (k = j + 1; k < codes.size() && codes[k] == codes[k - 1] + 1; k++);
+        add(codes[j], codes[k - 1]);
+    }
+    return !codes.empty();
+}
 
-    switch(p)
+// Compare each file with the first as they are read, keeping only the 
+// current item of each in memory. Items are counted, or printed as records, 
+// as they are found
+
+int StreamFiles(
+    streams_type& streams,
+    files_type const& names,
+    std::string const& nameinfo,
+    Qcn::cmp const cmp,
+    printformat const pf,
+    qcn::IgnoreRules const* rules,
+    run_stats* st
+)
+{
+    bool const many = names.size() > 2;
+    bool const records = pf == json || pf == csv;
+    files_type errors(names.size());
+    summary_type summary;
+    int status = 0;
+
+    qcn::NvTable dict(nameinfo);
+    qcn::NvTable const* info = 0;
+
+    if (records)
     {
-        case interleave:
+        qcn::StageTimer t(st ? &st->dictionary : 0);
+        info = dict.Open() ? &dict : 0;
+    }
 
-            for (auto i = d.begin(); i != d.end(); ++i)
-            {
-                auto p = *i;
-                
-                if (printinfo) 
-                {
-                    auto j = dict.Find(p.first.code);                    
-                    
-                    if (j != dict.end())
-                    {
-                        auto q = *j;
-                        
-                        p.first.description = q.description;
-                        p.second.description = q.description;
-                        
-                        p.first.category = q.category;
-                        p.second.category = q.category;
-                    }
-                }
-
-                std::cout << '[' << fileone << "]: ";
-                std::cout << p.first << std::endl;
-
-                std::cout << '[' << filetwo << "]: ";
-                std::cout << p.second << std::endl;
-            }
-            break;
+    qcn::ReportWriter out(std::cout);
+    if (pf == csv) PrintCsvHeader(out);
 
-        case sequential:
+    for (std::size_t i = 1; i < names.size(); i++)
+    {
+        qcn::QcnStream& baseline = *streams[0];
+        qcn::QcnStream& file = *streams[i];
+        std::size_t found = 0;
 
-            std::cout << '[' << fileone << "]: " << std::endl << std::endl; 
-            for (auto i = d.begin(); i != d.end(); ++i)
-            {
-                auto p = *i;
-                std::cout << p.first << std::endl;
-            }
+        // The baseline is read again from the start for each file
 
-            std::cout << '[' << filetwo << "]: " << std::endl << std::endl;
-            for (auto i = d.begin(); i != d.end(); ++i)
-            {
-                auto p = *i;
-                std::cout << p.second << std::endl;
-            }
-            break;
-         
-        default:
+        if (i > 1 && !baseline.Open())
+        {
+            out.Flush();
+            (records ? std::cerr : std::cout) << names[0] << ": " 
+                << baseline.ErrorMessage() << std::endl;
+            status = 1;
             break;
+        }
+
+        // Records are printed as part of the comparison
+
+        bool valid;
+        {
+            qcn::StageTimer t(st ? &st->compare : 0);
+            valid = qcn::CompareStream(
+                baseline, file, cmp, [&](qcn::qref const& r) {
+                    if (records) PrintRecord(out, r, names[0], names[i], info, pf);
+                    else if (many) AddSummary(summary, r, i - 1, names.size() - 1);
+                    found++;
+                }, rules
+            );
+        }
+        qcn::StageTimer t(st ? &st->output : 0);
+
+        if (!valid)
+        {
+            std::size_t const bad = baseline.Failed() ? 0 : i;
+            out.Flush();
+            (records ? std::cerr : std::cout) << names[bad] 
+                << ": Invalid format input file" << std::endl;
+            errors[i] = "Invalid format input file";
+            status = 1;
+        }
+        else if (!records)
+        {
+            if (many) out << "\n[" << names[0] << "] vs [" << names[i] << "]\n";
+            out << "\nFound ";
+            out.Decimal(found) << " non matching items\n\n";
+        }
+
+        streams[i].reset();
+        out.Flush();
+    }
+
+    if (many && !records)
+    {
+        qcn::StageTimer t(st ? &st->output : 0);
+        PrintSummary(out, summary, names, errors, 0);
+        out.Flush();
     }
+    return status;
 }
 
 int main(int argc, char *argv[])
 {
     Qcn::cmp cmp;
-    std::string nameone, nametwo, nameinfo;
+    files_type files;
+    std::string nameinfo;
     printformat pf;
+    qcn::uint jobs;
+    bool cache;
+    std::string compile;
+    bool stream;
+    bool stats, statsjson;
+    qcn::CodeFilter filter;
+    files_type categories;
+    std::string rulesfile;
     
-    if (ProcessCommandLine(argc, argv, cmp, pf, nameone, nametwo, nameinfo))
+    if (!ProcessCommandLine(
+            argc, argv, cmp, pf, files, nameinfo, jobs, cache, compile, stream,
+            stats, statsjson, filter, categories, rulesfile
+        ))
     {
-        qcn::Qcn fileone(nameone), filetwo(nametwo);        
-        auto n1 = fs::path(nameone).filename().string();
-        auto n2 = fs::path(nametwo).filename().string();
+        return 0;
+    }
 
-        if (fileone.Open() && filetwo.Open())
+    run_stats collected;
+    run_stats* const st = stats || statsjson ? &collected : 0;
+    StatsReport report(st, statsjson);
+
+    if (!compile.empty())
+    {
+        qcn::NvTable dict(nameinfo);
+        boost::system::error_code ec;
+
+        if (fs::exists(compile, ec) && fs::equivalent(nameinfo, compile, ec))
         {
-            
-            auto d = qcn::Compare(fileone, filetwo, cmp);
-            PrintOutput(d, n1, n2, nameinfo, pf);    
+            std::cout << compile << ": Output file is the input file" << std::endl;
+            return 1;
         }
-        else 
+        if (!dict.Open())
         {
-            if (!fileone.IsOpen())
+            std::cout << nameinfo << ": " << dict.ErrorMessage() << std::endl;
+            return 1;
+        }
+        if (!dict.Save(compile))
+        {
+            std::cout << compile << ": Could not write output file" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // The first file is the baseline with which each of the others is 
+    // compared. The baseline and the dictionary are loaded only once
+
+    bool const many = files.size() > 2;
+    bool const records = pf == json || pf == csv;
+    files_type names, errors(files.size());
+    int status = 0;
+
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        names.push_back(fs::path(*i).filename().string());
+    }
+
+    qcn::IgnoreRules ignore;
+    qcn::IgnoreRules const* const rules = rulesfile.empty() ? 0 : &ignore;
+
+    // Rules are read, like the dictionary, before any file
+
+    if (rules)
+    {
+        qcn::StageTimer t(st ? &st->dictionary : 0);
+
+        if (!ignore.Open(rulesfile))
+        {
+            (records ? std::cerr : std::cout) << rulesfile << ": " 
+                << ignore.ErrorMessage() << std::endl;
+            return 1;
+        }
+    }
+
+    // Categories are resolved to codes through the whole dictionary before
+    // any file is read, so that the items of other codes are passed over
+    // as the files are parsed
+
+    if (!categories.empty() || !ignore.Categories().empty())
+    {
+        qcn::StageTimer t(st ? &st->dictionary : 0);
+        qcn::NvTable table(nameinfo);
+
+        if (!table.Open())
+        {
+            (records ? std::cerr : std::cout) << nameinfo << ": " 
+                << table.ErrorMessage() << std::endl;
+            return 1;
+        }
+        std::string unknown;
+
+        for (auto i = categories.begin(); i != categories.end(); ++i)
+        {
+            if (!AddCategory(table, *i, [&filter](qcn::uint a, qcn::uint b) {
+                filter.Add(a, b);
+            }))
             {
-                std::cout << n1 << ": ";
-                std::cout << fileone.ErrorMessage() << std::endl;
+                unknown = *i;
             }
-            if (!filetwo.IsOpen())
+        }
+        files_type const& ignored = ignore.Categories();
+        for (auto i = ignored.begin(); i != ignored.end(); ++i)
+        {
+            if (!AddCategory(table, *i, [&ignore](qcn::uint a, qcn::uint b) {
+                ignore.Ignore(a, b);
+            }))
             {
-                std::cout << n2 << ": ";
-                std::cout << filetwo.ErrorMessage() << std::endl;
+                unknown = *i;
             }
+        }
+        if (!unknown.empty())
+        {
+            (records ? std::cerr : std::cout) << nameinfo 
+                << ": No items in category " << unknown << std::endl;
             return 1;
         }
     }
-    return 0;
-}
 
+    qcn::CodeFilter const* const only = 
+        filter.Empty() && categories.empty() ? 0 : &filter;
+
+    // With --stream the files are compared as they are read, when all of
+    // them can be read that way and the format needs no count before the
+    // items. Otherwise they are loaded whole
+
+    // stdin is never streamed, since once read it could not be loaded 
+    // again should another file not stream
+
+    if (stream && (pf == count || records))
+    {
+        streams_type streams;
+        bool streamable = 
+            std::find(files.begin(), files.end(), "-") == files.end();
+
+        for (auto i = files.begin(); streamable && i != files.end(); ++i)
+        {
+            streams.emplace_back(new qcn::QcnStream(*i));
+            streams.back()->SetFilter(only);
+            streamable = streams.back()->Open();
+        }
+        if (streamable)
+        {
+            return StreamFiles(streams, names, nameinfo, cmp, pf, rules, st);
+        }
+    }
+
+    // Files are loaded on a pool of worker threads while this thread 
+    // compares them in order. Only a few files per worker are held in 
+    // memory ahead of the one being compared. The pool is declared after
+    // what its tasks refer to so that it stops before that is destroyed
+
+    if (st)
+    {
+        st->files.resize(files.size());
+        for (std::size_t i = 0; i < files.size(); i++) st->files[i].name = names[i];
+    }
+
+    std::vector< std::unique_ptr<qcn::Qcn> > qcns(files.size());
+    std::vector< std::future<void> > loaded(files.size());
+    qcn::NvTable dict(nameinfo);
+    qcn::WorkerPool pool(jobs ? jobs : qcn::WorkerPool::DefaultSize());
+
+    std::size_t const window = 2 * pool.Size() + 1;
+    std::size_t next = 0;
+
+    // Workers left over when there are fewer files than workers help 
+    // to parse each large file
+
+    qcn::uint const threads = std::max<qcn::uint>(
+        1, pool.Size() / std::min<qcn::uint>(pool.Size(), files.size())
+    );
+
+    auto load = [&](std::size_t const i) {
+        qcns[i].reset(new qcn::Qcn(files[i]));
+        qcns[i]->SetThreads(threads);
+        qcns[i]->SetCache(cache);
+        qcns[i]->SetFilter(only);
+        qcns[i]->SetStats(st ? &st->files[i].load : 0);
+        qcn::Qcn* q = qcns[i].get();
+        loaded[i] = pool.Run([q]() { q->Open(); });
+    };
+
+    for (; next < files.size() && next < window; next++) load(next);
+
+    loaded[0].get();
+    qcn::Qcn const& baseline = *qcns[0];
+    if (!baseline.IsOpen())
+    {
+        // Nothing can be compared, but the errors of the other files are
+        // reported as well, as each is loaded
+
+        std::ostream& o = records ? std::cerr : std::cout;
+        o << names[0] << ": " << qcns[0]->ErrorMessage() << std::endl;
+
+        for (std::size_t i = 1; i < files.size(); i++)
+        {
+            loaded[i].get();
+            if (!qcns[i]->IsOpen())
+            {
+                o << names[i] << ": " << qcns[i]->ErrorMessage() << std::endl;
+            }
+            qcns[i].reset();
+            if (next < files.size()) load(next++);
+        }
+        return 1;
+    }
+
+    // Descriptions are read from the dictionary only for the codes that 
+    // differ, and not at all when the output does not show them
+
+    bool const describe = pf == interleave || pf == delta 
+        || (many && pf != count);
+    qcn::NvTable const* info = 0;
+    summary_type summary;
+
+    // The report is written in large blocks, once for each file compared
+
+    qcn::ReportWriter out(std::cout);
+
+    // Records are written as the items are compared and carry labels for 
+    // all the codes, so the whole dictionary is read up front. Errors go
+    // to stderr so that only records are written to stdout
+
+    if (records)
+    {
+        qcn::StageTimer t(st ? &st->dictionary : 0);
+        info = dict.Open() ? &dict : 0;
+        if (pf == csv) PrintCsvHeader(out);
+    }
+
+    for (std::size_t i = 1; i < names.size(); i++)
+    {
+        loaded[i].get();
+        qcn::Qcn& file = *qcns[i];
+
+        if (!file.IsOpen())
+        {
+            if (records)
+            {
+                std::cerr << names[i] << ": " << file.ErrorMessage() << std::endl;
+            }
+            else
+            {
+                out << names[i] << ": " << file.ErrorMessage() << '\n';
+            }
+            errors[i] = file.ErrorMessage();
+            status = 1;
+        }
+        else if (records)
+        {
+            // records are printed as part of the comparison
+
+            qcn::StageTimer t(st ? &st->compare : 0);
+            qcn::CompareEach(baseline, file, cmp, [&](qcn::qref const& r) {
+                PrintRecord(out, r, names[0], names[i], info, pf);
+            }, rules);
+        }
+        else
+        {
+            if (many)
+            {
+                out << "\n[" << names[0] << "] vs [" << names[i] << "]\n";
+            }
+
+            qcn::diff_ref_type d;
+            {
+                qcn::StageTimer t(st ? &st->compare : 0);
+                d = qcn::CompareRefs(baseline, file, cmp, rules);
+            }
+            if (describe)
+            {
+                qcn::StageTimer t(st ? &st->dictionary : 0);
+                info = dict.Open(DescribedCodes(d)) ? &dict : 0;
+            }
+
+            qcn::StageTimer t(st ? &st->output : 0);
+            PrintOutput(out, d, names[0], names[i], info, pf);
+            AddSummary(summary, d, i - 1, names.size() - 1);
+        }
+
+        // release the file and start loading the next one
+
+        qcns[i].reset();
+        if (next < files.size()) load(next++);
+
+        qcn::StageTimer t(st ? &st->output : 0);
+        out.Flush();
+    }
+
+    if (many && !records)
+    {
+        qcn::StageTimer t(st ? &st->output : 0);
+        PrintSummary(out, summary, names, errors, info);
+        out.Flush();
+    }
+    return status;
+}
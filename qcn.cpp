@@ -21,51 +21,2715 @@ Copyright 2014 dl12345@xda-developers forum
 #endif
 
 #include <string>
+#include <iostream>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <zlib.h>
+#ifdef QCN_ZSTD
+#include <zstd.h>
+#endif
 #include "qcn.hpp"
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QCN_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace qcn
 {   
-    diff_type const Compare(
-        Qcn const& lhs, 
-        Qcn const& rhs, 
-        Qcn::cmp const cmp,        
-        bool const recurse
+    bool const InputFile::Open()
+    {
+        namespace fs = boost::filesystem;
+        namespace ipc = boost::interprocess;
+
+        boost::system::error_code ec;
+
+        // Only map non-empty regular files. Mapping a zero length file fails
+        // and opening a fifo twice would lose data, so those are read instead
+
+        if (filename_ != "-" 
+            && fs::is_regular_file(filename_, ec) 
+            && fs::file_size(filename_, ec) > 0 
+            && !ec)
+        {
+            try
+            {
+                ipc::file_mapping f(filename_.c_str(), ipc::read_only);
+                ipc::mapped_region r(f, ipc::read_only);
+                region_.swap(r);
+
+                begin_ = static_cast<char const*>(region_.get_address());
+                end_ = begin_ + region_.get_size();
+                mapped_ = true;
+                return Expand();
+            }
+            catch (ipc::interprocess_exception const&)
+            {
+                // fall through and read the file as a stream
+            }
+        }
+
+        if (filename_ == "-")
+        {
+            buffer_.assign(
+                std::istreambuf_iterator<char>(std::cin), 
+                std::istreambuf_iterator<char>()
+            );
+        }
+        else
+        {
+            std::ifstream in(filename_, std::ios::binary);
+            if (!in.is_open())
+            {
+                err_ = "Could not open input file";
+                return false;
+            }
+            buffer_.assign(
+                std::istreambuf_iterator<char>(in), 
+                std::istreambuf_iterator<char>()
+            );
+        }
+        begin_ = buffer_.data();
+        end_ = begin_ + buffer_.size();
+        mapped_ = false;
+        return Expand();
+    }
+
+    bool const InputFile::Expand()
+    {
+        if (!expand_ || Decompressor::Detect(begin_, end_) == compression_none)
+        {
+            return true;
+        }
+
+        Decompressor d(begin_, end_);
+        std::string text;
+
+        while (d.Read(text));
+        if (d.Failed())
+        {
+            err_ = d.ErrorMessage();
+            return false;
+        }
+
+        buffer_.swap(text);
+        region_ = boost::interprocess::mapped_region();
+        begin_ = buffer_.data();
+        end_ = begin_ + buffer_.size();
+        mapped_ = false;
+        return true;
+    }
+
+    Decompressor::Decompressor(char const* begin, char const* end)
+        :   begin_(begin),
+            end_(end),
+            ring_(blocks, std::vector<char>(block_size)),
+            sizes_(blocks, 0),
+            head_(0),
+            count_(0),
+            done_(false),
+            failed_(false),
+            stop_(false)
+    {
+        thread_ = std::thread(&Decompressor::Run, this);
+    }
+
+    Decompressor::~Decompressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        emptied_.notify_all();
+        thread_.join();
+    }
+
+    compression_type const Decompressor::Detect(
+        char const* begin, 
+        char const* end
     )
     {
-        // option ::present will perform an inner join of non-matching items
-        // option ::missing will perform an outer join of missing items
-        // option ::both will perform an outer join of all non-matching items
+        static char const gzip[] = "\x1f\x8b";
+        static char const zstd[] = "\x28\xb5\x2f\xfd";
 
-        diff_type d;
-        for (auto l = lhs.begin(); l != lhs.end(); ++l)
-        {   
-            auto r = rhs.Find(l->code);
-            if (r != rhs.end())
-            {            
-                if (cmp != Qcn::cmp::missing && *l != *r) // inner join
+        if (end - begin >= 2 && std::equal(gzip, gzip + 2, begin))
+        {
+            return compression_gzip;
+        }
+        if (end - begin >= 4 && std::equal(zstd, zstd + 4, begin))
+        {
+            return compression_zstd;
+        }
+        return compression_none;
+    }
+
+    bool const Decompressor::Supports(compression_type const format)
+    {
+#ifdef QCN_ZSTD
+        return true;
+#else
+        return format != compression_zstd;
+#endif
+    }
+
+    bool const Decompressor::Read(std::string& out)
+    {
+        // The block at the head of the ring stays filled, and so out of 
+        // reach of the decompressor, until it has been copied
+
+        std::size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            filled_.wait(lock, [this]() { return count_ > 0 || done_; });
+            if (count_ == 0) return false;
+            slot = head_;
+        }
+
+        out.append(ring_[slot].data(), sizes_[slot]);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            head_ = (head_ + 1) % blocks;
+            count_--;
+        }
+        emptied_.notify_one();
+        return true;
+    }
+
+    void Decompressor::Run()
+    {
+        try
+        {
+            if (Detect(begin_, end_) == compression_gzip) Gzip();
+            else if (Detect(begin_, end_) == compression_zstd) Zstd();
+            else Fail("Unknown compression format");
+        }
+        catch (std::exception const&)
+        {
+            Fail("Could not decompress input");
+        }
+    }
+
+    char* Decompressor::Acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        emptied_.wait(lock, [this]() { return count_ < blocks || stop_; });
+        return stop_ ? 0 : ring_[(head_ + count_) % blocks].data();
+    }
+
+    void Decompressor::Publish(std::size_t const size, bool const last)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (size > 0)
+            {
+                sizes_[(head_ + count_) % blocks] = size;
+                count_++;
+            }
+            done_ = last;
+        }
+        filled_.notify_one();
+    }
+
+    void Decompressor::Fail(std::string const& err)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            err_ = err;
+            failed_ = true;
+            done_ = true;
+        }
+        filled_.notify_one();
+    }
+
+    void Decompressor::Gzip()
+    {
+        // Concatenated members, as written by appending to a .gz file, 
+        // decompress as one. zlib counts input in 32 bits, so a large 
+        // input is fed to it a piece at a time
+
+        static std::size_t const piece = 1 << 30;
+
+        z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+        {
+            Fail("Could not decompress input");
+            return;
+        }
+
+        char const* p = begin_;
+        bool last = false;
+
+        while (!last)
+        {
+            char* const out = Acquire();
+            if (!out) break;
+
+            z.next_out = reinterpret_cast<Bytef*>(out);
+            z.avail_out = block_size;
+
+            while (z.avail_out > 0)
+            {
+                if (z.avail_in == 0 && p != end_)
+                {
+                    std::size_t const n = std::min<std::size_t>(end_ - p, piece);
+                    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+                    z.avail_in = n;
+                    p += n;
+                }
+
+                int const r = inflate(&z, Z_NO_FLUSH);
+                if (r == Z_STREAM_END)
+                {
+                    if (z.avail_in == 0 && p == end_)
+                    {
+                        last = true;
+                        break;
+                    }
+                    inflateReset(&z);
+                }
+                else if (r != Z_OK)
+                {
+                    inflateEnd(&z);
+                    Fail("Corrupt or truncated compressed input");
+                    return;
+                }
+            }
+            Publish(block_size - z.avail_out, last);
+        }
+        inflateEnd(&z);
+    }
+
+#ifdef QCN_ZSTD
+    void Decompressor::Zstd()
+    {
+        // Consecutive frames decompress as one, as for gzip members
+
+        ZSTD_DStream* const z = ZSTD_createDStream();
+        if (!z || ZSTD_isError(ZSTD_initDStream(z)))
+        {
+            ZSTD_freeDStream(z);
+            Fail("Could not decompress input");
+            return;
+        }
+
+        ZSTD_inBuffer in = {begin_, std::size_t(end_ - begin_), 0};
+        std::size_t r = 0;
+        bool last = false;
+
+        while (!last)
+        {
+            char* const out = Acquire();
+            if (!out) break;
+
+            ZSTD_outBuffer o = {out, block_size, 0};
+
+            while (o.pos < o.size)
+            {
+                if (in.pos == in.size && r == 0)
+                {
+                    last = true;
+                    break;
+                }
+
+                std::size_t const before = o.pos;
+                r = ZSTD_decompressStream(z, &o, &in);
+
+                if (ZSTD_isError(r) 
+                    || (in.pos == in.size && o.pos == before && r != 0))
+                {
+                    ZSTD_freeDStream(z);
+                    Fail("Corrupt or truncated compressed input");
+                    return;
+                }
+            }
+            Publish(o.pos, last);
+        }
+        ZSTD_freeDStream(z);
+    }
+#else
+    void Decompressor::Zstd()
+    {
+        Fail("Not built with zstd support");
+    }
+#endif
+
+    WorkerPool::WorkerPool(uint const threads) : stop_(false)
+    {
+        for (uint i = 0; i < std::max(threads, 1u); i++)
+        {
+            threads_.push_back(std::thread(&WorkerPool::Work, this));
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            queue_.clear();
+        }
+        ready_.notify_all();
+
+        for (auto i = threads_.begin(); i != threads_.end(); ++i)
+        {
+            i->join();
+        }
+    }
+
+    std::future<void> WorkerPool::Run(task_type const& task)
+    {
+        // packaged_task is move only, which std::function cannot hold
+
+        auto t = std::make_shared< std::packaged_task<void()> >(task);
+        std::future<void> f = t->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back([t]() { (*t)(); });
+        }
+        ready_.notify_one();
+        return f;
+    }
+
+    uint const WorkerPool::DefaultSize()
+    {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    void WorkerPool::Work()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (stop_) return;
+
+                task = queue_.front();
+                queue_.pop_front();
+            }
+            task();
+        }
+    }
+
+    namespace
+    {
+        // Item statuses, in the order of qcn_status_type
+
+        char const* const statuses[] = {
+            "OK", "Inactive item", "Parameter bad", "Access denied"
+        };
+
+        // Layout of a .qcnidx file: the header, then an index_item for each
+        // item in the order they appear in the input, then the payloads. 
+        // Values are in the byte order of the machine that wrote the file; 
+        // order tells a reader whether it is the same as its own
+
+        char const index_magic[8] = { 'Q', 'C', 'N', 'I', 'D', 'X', 0, 1 };
+        uint32_t const index_order = 0x01020304;
+
+        struct index_header
+        {
+            char magic[8];
+            uint32_t order;
+            uint32_t items;
+            uint64_t size;
+            int64_t mtime;
+            uint64_t hash;
+            uint64_t bytes;
+        };
+
+        struct index_item
+        {
+            uint32_t code;
+            uint32_t status;
+            uint32_t offset;
+            uint32_t size;
+        };
+
+        // Layout of a compiled dictionary: the header, then for each code 
+        // below codes the offsets of its description and category in the 
+        // strings that follow, or none. Codes of table_dense and above are
+        // listed after them, in ascending order with their offsets, so that
+        // a stray large code does not swell the table. Each string is a 16
+        // bit length and the text. Values are in the byte order of the 
+        // machine that wrote the table, as for the index
+
+        char const table_magic[8] = { 'Q', 'C', 'N', 'N', 'V', 'D', 0, 1 };
+        uint32_t const table_none = 0xFFFFFFFF;
+        uint32_t const table_dense = 1 << 16;
+
+        struct table_header
+        {
+            char magic[8];
+            uint32_t order;
+            uint32_t codes;
+            uint32_t bytes;
+            uint32_t sparse;
+        };
+
+        struct table_sparse
+        {
+            uint32_t code;
+            uint32_t description;
+            uint32_t category;
+        };
+
+        inline uint32_t const Read32(char const* p)
+        {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        // Values in a compound document are little endian, whatever the 
+        // byte order of the machine reading it
+
+        inline uint32_t const ReadLE16(char const* p)
+        {
+            uint8_t const* q = reinterpret_cast<uint8_t const*>(p);
+            return q[0] | q[1] << 8;
+        }
+
+        inline uint32_t const ReadLE32(char const* p)
+        {
+            return ReadLE16(p) | ReadLE16(p + 2) << 16;
+        }
+
+        inline uint64_t const ReadLE64(char const* p)
+        {
+            return ReadLE32(p) | uint64_t(ReadLE32(p + 4)) << 32;
+        }
+
+        // Compound document signature, and the sector numbers that end a 
+        // chain and mark an unused entry
+
+        char const compound_magic[8] = { 
+            '\xD0', '\xCF', '\x11', '\xE0', '\xA1', '\xB1', '\x1A', '\xE1' 
+        };
+        uint32_t const compound_end = 0xFFFFFFFE;
+        uint32_t const compound_none = 0xFFFFFFFF;
+
+        inline bool const SameName(std::string const& a, std::string const& b)
+        {
+            if (a.size() != b.size()) return false;
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                if (std::tolower(uint8_t(a[i])) != std::tolower(uint8_t(b[i])))
                 {
-                    pair_type p(*l, *r);
-                    d.push_back(p);
+                    return false;
                 }
             }
-            else if (cmp != Qcn::cmp::present) // left outer join missing items
+            return true;
+        }
+
+        inline boost::string_ref const ReadString(char const* p)
+        {
+            uint16_t n;
+            std::memcpy(&n, p, sizeof(n));
+            return boost::string_ref(p + sizeof(n), n);
+        }
+
+        // 64 bit FNV-1a hash of the input, used to detect a changed input 
+        // whose size and modification time are the same
+
+        uint64_t const Fnv1a(char const* p, char const* end)
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (; p != end; ++p)
+            {
+                h = (h ^ static_cast<uint8_t>(*p)) * 0x100000001b3ULL;
+            }
+            return h;
+        }
+
+        // Same set of characters as the ascii::space skipper
+
+        inline bool const IsSpace(char const c)
+        {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        inline int const HexDigit(char const c)
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            return -1;
+        }
+
+        // Decode one row of 16 item bytes laid out as "XX XX ... XX" and 
+        // terminated by whitespace. The row occupies 48 bytes including the
+        // terminator, all of which must be readable. Returns false without
+        // touching out if the row is not in exactly this layout
+
+#ifdef QCN_SSE2
+
+        bool const DecodeRow(char const* p, uint8_t* out)
+        {
+            // bit i of a mask refers to byte i of the 48 byte row; digits 
+            // sit at offsets 3k and 3k+1 and separators at 3k+2
+
+            static uint64_t const digits = 0x6db6db6db6dbULL;
+            static uint64_t const spaces = 0x124924924924ULL & ~(1ULL << 47);
+
+            __m128i const v[3] = {
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 32))
+            };
+
+            uint64_t valid = 0, blank = 0;
+            unsigned char nibble[48];
+
+            for (int j = 0; j < 3; j++)
+            {
+                __m128i const c = v[j];
+                __m128i const l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+                __m128i const d = _mm_and_si128(
+                    _mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                    _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1))
+                );
+                __m128i const a = _mm_and_si128(
+                    _mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                    _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1))
+                );
+                __m128i const n = _mm_or_si128(
+                    _mm_and_si128(d, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                    _mm_and_si128(a, _mm_sub_epi8(l, _mm_set1_epi8('a' - 10)))
+                );
+
+                uint64_t const ok = _mm_movemask_epi8(_mm_or_si128(d, a));
+                uint64_t const sp = _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(c, _mm_set1_epi8(' '))
+                );
+                valid |= ok << (16 * j);
+                blank |= sp << (16 * j);
+
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i*>(nibble + 16 * j), n
+                );
+            }
+
+            if ((valid & digits) != digits 
+                || (blank & spaces) != spaces 
+                || !IsSpace(p[47]))
+            {
+                return false;
+            }
+
+            for (int k = 0; k < 16; k++)
             {
-                Qcn::item empty;
-                pair_type p(*l, empty);
-                d.push_back(p);
+                out[k] = (nibble[3 * k] << 4) | nibble[3 * k + 1];
             }
+            return true;
         }
-        if (cmp != Qcn::cmp::present && recurse) // right outer join missing items
+
+#else
+
+        bool const DecodeRow(char const* p, uint8_t* out)
         {
-            auto rhs_only = Compare(rhs, lhs, Qcn::cmp::missing, false);
-            for (auto s = rhs_only.begin(); s != rhs_only.end(); ++s)
+            uint8_t row[16];
+            for (int k = 0; k < 16; k++)
             {
-                // swap the order so that we have rhs and lhs correctly ordered
+                int const h = HexDigit(p[3 * k]);
+                int const l = HexDigit(p[3 * k + 1]);
+                char const s = p[3 * k + 2];
+
+                if (h < 0 || l < 0 || (k < 15 ? s != ' ' : !IsSpace(s)))
+                {
+                    return false;
+                }
+                row[k] = (h << 4) | l;
+            }
+            std::copy(row, row + 16, out);
+            return true;
+        }
+
+#endif
+
+        // The two hex digits of each byte value
+
+        struct hex_table
+        {
+            char digits[512];
 
-                Qcn::item empty;
-                pair_type p(empty, s->first);
-                d.push_back(p);
+            hex_table()
+            {
+                char const* const hex = "0123456789ABCDEF";
+                for (uint i = 0; i < 256; i++)
+                {
+                    digits[2 * i] = hex[i >> 4];
+                    digits[2 * i + 1] = hex[i & 0xF];
+                }
             }
+        } const hex_pairs;
+    }
+
+    double const StageTimer::Wall()
+    {
+        std::chrono::duration<double> const t = 
+            std::chrono::steady_clock::now().time_since_epoch();
+        return t.count();
+    }
+
+    double const StageTimer::ThreadCpu()
+    {
+#ifdef _WIN32
+        FILETIME created, exited, kernel, user;
+        GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+        uint64_t const k = (uint64_t(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+        uint64_t const u = (uint64_t(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+        return (k + u) * 1e-7;
+#else
+        timespec t;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+    }
+
+    double const StageTimer::ProcessCpu()
+    {
+#ifdef _WIN32
+        FILETIME created, exited, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+        uint64_t const k = (uint64_t(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+        uint64_t const u = (uint64_t(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+        return (k + u) * 1e-7;
+#else
+        timespec t;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+    }
+
+    uint64_t const PeakRss()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS c;
+        GetProcessMemoryInfo(GetCurrentProcess(), &c, sizeof(c));
+        return c.PeakWorkingSetSize / 1024;
+#else
+        struct rusage u;
+        getrusage(RUSAGE_SELF, &u);
+        return u.ru_maxrss;
+#endif
+    }
+
+    char* ReportWriter::Reserve(std::size_t const n)
+    {
+        if (buffer_.size() - used_ < n)
+        {
+            Flush();
+            if (buffer_.size() < n) buffer_.resize(n);
+        }
+        char* const p = buffer_.data() + used_;
+        used_ += n;
+        return p;
+    }
+
+    void ReportWriter::Flush()
+    {
+        if (used_ == 0) return;
+        o_.write(buffer_.data(), used_);
+        used_ = 0;
+    }
+
+    ReportWriter& ReportWriter::Write(char const* s, std::size_t const n)
+    {
+        if (n > buffer_.size())
+        {
+            Flush();
+            o_.write(s, n);
+            return *this;
+        }
+        std::memcpy(Reserve(n), s, n);
+        return *this;
+    }
+
+    ReportWriter& ReportWriter::Decimal(uint64_t v, uint const width, char const fill)
+    {
+        char digits[24];
+        char* p = digits + sizeof(digits);
+        do
+        {
+            *--p = '0' + v % 10;
+            v /= 10;
+        }
+        while (v);
+
+        std::size_t const n = digits + sizeof(digits) - p;
+        if (n < width) std::memset(Reserve(width - n), fill, width - n);
+        return Write(p, n);
+    }
+
+    ReportWriter& ReportWriter::Hex(uint64_t v, uint const width)
+    {
+        char digits[16];
+        char* p = digits + sizeof(digits);
+        do
+        {
+            *--p = hex_pairs.digits[2 * (v & 0xF) + 1];
+            v >>= 4;
+        }
+        while (v);
+
+        std::size_t const n = digits + sizeof(digits) - p;
+        if (n < width) std::memset(Reserve(width - n), '0', width - n);
+        return Write(p, n);
+    }
+
+    ReportWriter& ReportWriter::Byte(uint8_t const v)
+    {
+        std::memcpy(Reserve(2), hex_pairs.digits + 2 * v, 2);
+        return *this;
+    }
+
+    ReportWriter& ReportWriter::Rows(qcn_item_data_type const& data)
+    {
+        // Each row of 16 bytes takes 48 characters including its newline
+
+        std::size_t const size = data.size();
+        if (size == 0) return *this;
+
+        char* p = Reserve(3 * size);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            std::memcpy(p, hex_pairs.digits + 2 * data[i], 2);
+            p[2] = (i % 16 == 15 || i + 1 == size) ? '\n' : ' ';
+            p += 3;
+        }
+        return *this;
+    }
+
+    char const* const StatusText(qcn_status_type const status)
+    {
+        return status < status_missing ? statuses[status] : "Missing";
+    }
+
+    ReportWriter& ReportWriter::Item(qcn_item_type const& q)
+    {
+        Decimal(q.code, 4);
+
+        if (!q.description.empty())
+        {
+            *this << " (" << q.description << ", " << q.category;
+        }
+        else
+        {
+            *this << " (0x";
+            Hex(q.code, 4);
+        }
+        *this << ") - " << StatusText(q.status) << '\n';
+        return Rows(q.data);
+    }
+
+    void CodeFilter::Add(uint const first, uint const last)
+    {
+        // insert the range, then merge any that now overlap or touch
+
+        ranges_.insert(
+            std::upper_bound(
+                ranges_.begin(), ranges_.end(), std::make_pair(first, last)
+            ),
+            std::make_pair(first, last)
+        );
+
+        std::vector< std::pair<uint, uint> > merged;
+        for (auto i = ranges_.begin(); i != ranges_.end(); ++i)
+        {
+            if (!merged.empty() && (merged.back().second == ~0u 
+                || i->first <= merged.back().second + 1))
+            {
+                merged.back().second = std::max(merged.back().second, i->second);
+            }
+            else
+            {
+                merged.push_back(*i);
+            }
+        }
+        ranges_.swap(merged);
+    }
+
+    bool const CodeFilter::Add(std::string const& ranges)
+    {
+        // Codes are decimal, or hex with a 0x prefix as in the item lines
+
+        auto number = [](char const*& p, char const* end, uint& value) {
+            uint64_t v = 0;
+            int const base = end - p > 2 && p[0] == '0' 
+                && (p[1] == 'x' || p[1] == 'X') ? 16 : 10;
+            if (base == 16) p += 2;
+
+            char const* q = p;
+            for (int d; q != end && (d = HexDigit(*q)) >= 0 && d < base; ++q)
+            {
+                v = v * base + d;
+                if (v > 0xFFFFFFFFULL) return false;
+            }
+            if (q == p) return false;
+            p = q;
+            value = static_cast<uint>(v);
+            return true;
+        };
+
+        std::vector< std::pair<uint, uint> > added;
+        char const* p = ranges.data();
+        char const* const end = p + ranges.size();
+
+        for (;;)
+        {
+            uint first, last;
+
+            while (p != end && IsSpace(*p)) ++p;
+            if (!number(p, end, first)) return false;
+            last = first;
+
+            while (p != end && IsSpace(*p)) ++p;
+            if (p != end && *p == '-')
+            {
+                ++p;
+                while (p != end && IsSpace(*p)) ++p;
+                if (!number(p, end, last) || last < first) return false;
+                while (p != end && IsSpace(*p)) ++p;
+            }
+            added.push_back(std::make_pair(first, last));
+
+            if (p == end) break;
+            if (*p++ != ',') return false;
+        }
+
+        for (auto i = added.begin(); i != added.end(); ++i)
+        {
+            Add(i->first, i->second);
+        }
+        return true;
+    }
+
+    void QcnScanner::Skip()
+    {
+        while (p_ != end_ && IsSpace(*p_)) ++p_;
+    }
+
+    bool const QcnScanner::Literal(char const* s)
+    {
+        Skip();
+        char const* q = p_;
+        for (; *s; ++s, ++q)
+        {
+            if (q == end_ || *q != *s) return false;
+        }
+        p_ = q;
+        return true;
+    }
+
+    bool const QcnScanner::Decimal(uint& value)
+    {
+        Skip();
+        uint64_t v = 0;
+        char const* q = p_;
+        for (; q != end_ && *q >= '0' && *q <= '9'; ++q)
+        {
+            v = v * 10 + (*q - '0');
+            if (v > 0xFFFFFFFFULL) return false;
+        }
+        if (q == p_) return false;
+        p_ = q;
+        value = static_cast<uint>(v);
+        return true;
+    }
+
+    bool const QcnScanner::Hex(uint& value)
+    {
+        Skip();
+        uint v = 0;
+        char const* q = p_;
+        for (int h; q != end_ && (h = HexDigit(*q)) >= 0; ++q)
+        {
+            if (q - p_ == 8) return false;
+            v = (v << 4) | h;
+        }
+        if (q == p_) return false;
+        p_ = q;
+        value = v;
+        return true;
+    }
+
+    bool const QcnScanner::Header()
+    {
+        // As in the grammar the item size takes effect as soon as it is 
+        // read, and a header that is not a size declaration is a label
+
+        uint n;
+
+        if (!Literal("[")) return false;
+        char const* label = p_;
+
+        if (Literal("Complete items") && Literal("-") && Decimal(n)
+            && Literal(",") 
+            && Literal("Items size") && Literal("-"))
+        {
+            bool declared = true;
+
+            if (Decimal(size_))
+            {
+                variable_ = false;
+            }
+            else if (Literal("variable"))
+            {
+                variable_ = true;
+            }
+            else
+            {
+                declared = false;
+            }
+            if (declared && Literal("]")) return true;
+        }
+
+        p_ = label;
+        Skip();
+
+        char const* q = p_;
+        while (q != end_ && *q != ']' && *q != '\r' && *q != '\n') ++q;
+        if (q == p_) return false;
+
+        p_ = q;
+        return Literal("]");
+    }
+
+    bool const QcnScanner::Headers()
+    {
+        Skip();
+        if (p_ == end_ || *p_ != '[') 
+        {
+            failed_ = true;
+            return false;
+        }
+        while (p_ != end_ && *p_ == '[')
+        {
+            if (!Header())
+            {
+                failed_ = true;
+                return false;
+            }
+            Skip();
+        }
+        return true;
+    }
+
+    bool const QcnScanner::Leaf(qcn_item_data_type& data, uint const size)
+    {
+        uint const offset = arena_.size();
+        arena_.resize(offset + size);
+
+        uint8_t* out = arena_.data() + offset;
+        uint n = size;
+        uint v;
+
+        while (n)
+        {
+            Skip();
+            if (n >= 16 && end_ - p_ >= 48 && DecodeRow(p_, out))
+            {
+                p_ += 47;
+                out += 16;
+                n -= 16;
+            }
+            else if (Hex(v) && v <= 0xFF)
+            {
+                *out++ = static_cast<uint8_t>(v);
+                --n;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        data = qcn_item_data_type(&arena_, offset, size);
+        return true;
+    }
+
+    bool const QcnScanner::ByteEnds(char const* q) const
+    {
+        // Two digits at q - 2 are a byte of an open ended payload unless 
+        // they run on into more digits or are the code of the next item
+
+        if (q != end_ && HexDigit(*q) >= 0) return false;
+        while (q != end_ && IsSpace(*q)) ++q;
+        return q == end_ || *q != '(';
+    }
+
+    bool const QcnScanner::OpenLeaf(qcn_item_data_type& data)
+    {
+        uint const offset = arena_.size();
+        uint8_t row[16];
+
+        for (;;)
+        {
+            Skip();
+            if (end_ - p_ >= 48 && DecodeRow(p_, row) && ByteEnds(p_ + 47))
+            {
+                arena_.insert(arena_.end(), row, row + 16);
+                p_ += 47;
+            }
+            else if (end_ - p_ >= 2 && HexDigit(p_[0]) >= 0 
+                && HexDigit(p_[1]) >= 0 && ByteEnds(p_ + 2))
+            {
+                arena_.push_back(static_cast<uint8_t>(
+                    (HexDigit(p_[0]) << 4) | HexDigit(p_[1])
+                ));
+                p_ += 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+        data = qcn_item_data_type(&arena_, offset, arena_.size() - offset);
+        return true;
+    }
+
+    bool const QcnScanner::Next(qcn_item_type& item)
+    {
+        uint discard;
+
+        for (;;)
+        {
+            Skip();
+            if (failed_ || p_ == end_) return false;
+
+            // Headers between items open a new section
+
+            if (*p_ == '[' && (!Headers() || p_ == end_)) return false;
+
+            item.data = qcn_item_data_type();
+            item.status = status_missing;
+
+            if (!(Decimal(item.code) 
+                && Literal("(") && Literal("0x") && Hex(discard) && Literal(")")
+                && Literal("-")))
+            {
+                failed_ = true;
+                return false;
+            }
+
+            if (!filter_ || filter_->Accepts(item.code)) break;
+            if (!Pass()) return false;
+        }
+
+        if (Literal(statuses[0]))
+        {
+            uint length;
+
+            item.status = status_ok;
+            if (Literal("-") 
+                ? !(Decimal(length) && Leaf(item.data, length))
+                : !(variable_ ? OpenLeaf(item.data) : Leaf(item.data, size_)))
+            {
+                failed_ = true;
+                return false;
+            }
+            return true;
+        }
+        for (auto s = statuses + 1; s != statuses + status_missing; ++s)
+        {
+            if (Literal(*s))
+            {
+                item.status = static_cast<qcn_status_type>(s - statuses);
+                return true;
+            }
+        }
+        failed_ = true;
+        return false;
+    }
+
+    bool const QcnScanner::Pass()
+    {
+        // The payload of an item filtered out is not read. When its size is
+        // known it is jumped over whole, assuming the canonical layout of 
+        // rows of 16 bytes with the line ending of the item line, and any 
+        // blank lines after them. If that does not land on the next item,
+        // or the size is not known, the next line that starts an item or a
+        // header is searched for. This relies on each item starting on a 
+        // line of its own
+
+        uint length = size_;
+        bool sized = !variable_;
+
+        if (!Literal(statuses[0]))
+        {
+            for (auto s = statuses + 1; s != statuses + status_missing; ++s)
+            {
+                if (Literal(*s)) return true;
+            }
+            failed_ = true;
+            return false;
+        }
+        // the length, if any, is on the item line; without it the line
+        // ends here
+
+        char const* const line = p_;
+        if (Literal("-")) 
+        {
+            sized = Decimal(length);
+        }
+        else
+        {
+            p_ = line;
+        }
+
+        char const* eol = std::find(p_, end_, '\n');
+        if (sized && eol != end_)
+        {
+            std::size_t const rows = (length + 15) / 16;
+            std::size_t const crlf = eol[-1] == '\r' ? 1 : 0;
+            std::size_t const bytes = 3 * std::size_t(length) + crlf * rows;
+            char const* q = eol + 1;
+
+            if (std::size_t(end_ - q) >= bytes 
+                && (bytes == 0 || q[bytes - 1] == '\n'))
+            {
+                char const* r = q + bytes;
+                while (r != end_ && IsSpace(*r)) ++r;
+
+                if (r == end_ || (r[-1] == '\n' && Starts(r, end_, true)))
+                {
+                    p_ = r;
+                    return true;
+                }
+            }
+        }
+        p_ = FindItem(p_, end_, true);
+        return true;
+    }
+
+    bool const NvTable::Open()
+    {
+        if (!file_.Open())
+        {
+            err_ = file_.ErrorMessage();
+            return false;
+        }
+
+        std::size_t const size = file_.end() - file_.begin();
+        if (size >= sizeof(table_magic) 
+            && std::memcmp(file_.begin(), table_magic, sizeof(table_magic)) == 0)
+        {
+            if (Load(file_.begin(), file_.end())) return true;
+
+            err_ = "Invalid format input file";
+            return false;
+        }
+
+        Dictionary dict(filename_);
+        if (!dict.Open())
+        {
+            err_ = dict.ErrorMessage();
+            return false;
+        }
+        if (!Compile(dict))
+        {
+            err_ = "Dictionary too large to compile";
+            return false;
+        }
+        return Load(table_.data(), table_.data() + table_.size());
+    }
+
+    bool const NvTable::Open(std::vector<uint> const& codes)
+    {
+        if (begin_ != 0) return true;
+
+        if (!text_)
+        {
+            if (!file_.Open())
+            {
+                err_ = file_.ErrorMessage();
+                return false;
+            }
+
+            std::size_t const size = file_.end() - file_.begin();
+            if (size >= sizeof(table_magic) 
+                && std::memcmp(file_.begin(), table_magic, sizeof(table_magic)) == 0)
+            {
+                if (Load(file_.begin(), file_.end())) return true;
+
+                err_ = "Invalid format input file";
+                return false;
+            }
+            text_ = true;
+        }
+
+        std::vector<uint> wanted;
+
+        for (auto i = codes.begin(); i != codes.end(); ++i)
+        {
+            if (entries_.find(*i) == entries_.end()) wanted.push_back(*i);
+        }
+        if (wanted.empty()) return true;
+
+        std::sort(wanted.begin(), wanted.end());
+
+        // Entries are found by their quotes alone and only the wanted ones
+        // are parsed. As in the whole dictionary, a category that is not 
+        // closed runs on into the next line, and a later entry for a code
+        // replaces an earlier one
+
+        using spirit::ascii::space;    
+        using qi::eoi;
+
+        codeparser<char const*> parser;
+        char const* const end = file_.end();
+        char const* const quotes = "'\"";
+        char const* const closing = "*\"";
+
+        for (char const* entry = file_.begin(); entry != end; )
+        {
+            char const* p = entry;
+            while (p != end && IsSpace(*p)) ++p;
+
+            uint64_t code = 0;
+            char const* digits = p;
+            while (p != end && p - digits < 10 && *p >= '0' && *p <= '9')
+            {
+                code = code * 10 + (*p++ - '0');
+            }
+            bool const numbered = p != digits && code <= 0xFFFFFFFF;
+
+            p = std::find(p, end, '"');
+            if (p != end) p = std::find(p + 1, end, '"');
+            if (p != end) p = std::find_first_of(p + 1, end, quotes, quotes + 2);
+            if (p != end) p = std::find_first_of(p + 1, end, closing, closing + 2);
+            p = std::find(p, end, '\n');
+            if (p != end) ++p;
+
+            if (numbered 
+                && std::binary_search(wanted.begin(), wanted.end(), code))
+            {
+                dict_codes_type entries;
+                char const* begin = entry;
+
+                if (phrase_parse(begin, p, parser >> eoi, space, entries) 
+                    && entries.size() == 1)
+                {
+                    entries_[code] = entries.front();
+                }
+            }
+            entry = p;
+        }
+        return true;
+    }
+
+    bool const NvTable::Compile(Dictionary const& dict)
+    {
+        // Categories repeat heavily so each distinct one is stored once
+
+        uint64_t codes = 0;
+        for (auto i = dict.begin(); i != dict.end(); ++i)
+        {
+            codes = std::max<uint64_t>(codes, uint64_t(i->code) + 1);
+        }
+        codes = std::min<uint64_t>(codes, table_dense);
+
+        std::vector<uint32_t> entries(2 * codes, table_none);
+        std::vector<table_sparse> sparse;
+        std::string strings;
+        std::map<std::string, uint32_t> categories;
+
+        auto add = [&strings](std::string const& s) -> uint64_t {
+            uint64_t const offset = strings.size();
+            uint16_t const n = std::min<std::size_t>(s.size(), 0xFFFF);
+            strings.append(reinterpret_cast<char const*>(&n), sizeof(n));
+            strings.append(s, 0, n);
+            return offset;
+        };
+
+        for (auto i = dict.Sorted().begin(); i != dict.Sorted().end(); ++i)
+        {
+            auto c = categories.find((*i)->category);
+            if (c == categories.end())
+            {
+                c = categories.insert(
+                    std::make_pair((*i)->category, add((*i)->category))
+                ).first;
+            }
+            uint32_t const description = add((*i)->description);
+
+            if ((*i)->code < codes)
+            {
+                entries[2 * (*i)->code] = description;
+                entries[2 * (*i)->code + 1] = c->second;
+            }
+            else
+            {
+                table_sparse const s = { (*i)->code, description, c->second };
+                sparse.push_back(s);
+            }
+        }
+
+        // Offsets are 32 bits, so the strings must fit below table_none
+
+        if (strings.size() >= table_none || sparse.size() >= table_none) 
+        {
+            return false;
+        }
+
+        table_header h;
+        std::memcpy(h.magic, table_magic, sizeof(h.magic));
+        h.order = index_order;
+        h.codes = codes;
+        h.bytes = strings.size();
+        h.sparse = sparse.size();
+
+        char const* e = reinterpret_cast<char const*>(entries.data());
+        char const* s = reinterpret_cast<char const*>(sparse.data());
+
+        table_.clear();
+        table_.insert(
+            table_.end(), 
+            reinterpret_cast<char const*>(&h), 
+            reinterpret_cast<char const*>(&h + 1)
+        );
+        table_.insert(table_.end(), e, e + entries.size() * sizeof(uint32_t));
+        table_.insert(
+            table_.end(), s, s + sparse.size() * sizeof(table_sparse)
+        );
+        table_.insert(table_.end(), strings.begin(), strings.end());
+        return true;
+    }
+
+    bool const NvTable::Load(char const* begin, char const* end)
+    {
+        table_header h;
+        if (std::size_t(end - begin) < sizeof(h)) return false;
+        std::memcpy(&h, begin, sizeof(h));
+
+        if (std::memcmp(h.magic, table_magic, sizeof(h.magic)) != 0
+            || h.order != index_order
+            || uint64_t(end - begin) 
+                != sizeof(h) + 8 * uint64_t(h.codes) 
+                    + sizeof(table_sparse) * uint64_t(h.sparse) + h.bytes)
+        {
+            return false;
+        }
+        begin_ = begin;
+        end_ = end;
+        codes_ = h.codes;
+        sparse_ = h.sparse;
+        return true;
+    }
+
+    bool const NvTable::Find(uint const code, dict_entry& entry) const
+    {
+        if (begin_ == 0)
+        {
+            auto i = entries_.find(code);
+            if (i == entries_.end()) return false;
+
+            entry.description = i->second.description;
+            entry.category = i->second.category;
+            return true;
+        }
+
+        char const* const dense = begin_ + sizeof(table_header);
+        char const* const sparse = dense + 8 * uint64_t(codes_);
+        char const* const strings = 
+            sparse + sizeof(table_sparse) * uint64_t(sparse_);
+        char const* e;
+
+        if (code < codes_)
+        {
+            e = dense + 8 * uint64_t(code);
+        }
+        else
+        {
+            // Sparse codes are found by binary search on their records
+
+            uint32_t first = 0, last = sparse_;
+            while (first < last)
+            {
+                uint32_t const middle = first + (last - first) / 2;
+                if (Read32(sparse + sizeof(table_sparse) * middle) < code) 
+                {
+                    first = middle + 1;
+                }
+                else
+                {
+                    last = middle;
+                }
+            }
+            e = sparse + sizeof(table_sparse) * uint64_t(first);
+            if (first == sparse_ || Read32(e) != code) return false;
+            e += 4;
+        }
+
+        uint32_t const description = Read32(e);
+        uint32_t const category = Read32(e + 4);
+        if (description == table_none) return false;
+
+        // offsets are checked here rather than in Load so that opening a 
+        // table stays independent of its size
+
+        std::size_t const bytes = end_ - strings;
+
+        if (uint64_t(description) + 2 > bytes || uint64_t(category) + 2 > bytes)
+        {
+            return false;
+        }
+
+        entry.description = ReadString(strings + description);
+        entry.category = ReadString(strings + category);
+
+        if (entry.description.end() > end_ || entry.category.end() > end_)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    uint const NvTable::Size() const
+    {
+        if (begin_ == 0) return uint(entries_.size());
+
+        char const* const dense = begin_ + sizeof(table_header);
+        uint n = sparse_;
+
+        for (uint code = 0; code < codes_; code++)
+        {
+            n += Read32(dense + 8 * uint64_t(code)) != table_none;
+        }
+        return n;
+    }
+
+    std::vector<uint> const NvTable::Codes(std::string const& category) const
+    {
+        auto matches = [&category](boost::string_ref const c) {
+            if (c.size() < category.size()) return false;
+            for (std::size_t i = 0; i < category.size(); i++)
+            {
+                if (std::tolower(uint8_t(c[i])) != std::tolower(uint8_t(category[i])))
+                {
+                    return false;
+                }
+            }
+            return c.size() == category.size() || c[category.size()] == ' ';
+        };
+
+        std::vector<uint> codes;
+        dict_entry e;
+
+        if (begin_ == 0)
+        {
+            for (auto i = entries_.begin(); i != entries_.end(); ++i)
+            {
+                if (matches(i->second.category)) codes.push_back(i->first);
+            }
+            std::sort(codes.begin(), codes.end());
+        }
+        else
+        {
+            char const* const sparse = 
+                begin_ + sizeof(table_header) + 8 * uint64_t(codes_);
+
+            for (uint code = 0; code < codes_; code++)
+            {
+                if (Find(code, e) && matches(e.category)) codes.push_back(code);
+            }
+            for (uint i = 0; i < sparse_; i++)
+            {
+                uint const code = Read32(sparse + sizeof(table_sparse) * i);
+                if (Find(code, e) && matches(e.category)) codes.push_back(code);
+            }
+        }
+        return codes;
+    }
+
+    bool const NvTable::Save(std::string const& filename) const
+    {
+        // Written under a temporary name and renamed into place, so that a
+        // table being read, or a failed write, never leaves a partial file
+
+        namespace fs = boost::filesystem;
+
+        boost::system::error_code ec;
+        std::string const temporary = fs::unique_path(
+            filename + ".%%%%-%%%%-%%%%.tmp", ec
+        ).string();
+        if (ec) return false;
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(begin_, end_ - begin_);
+            if (!out.good())
+            {
+                out.close();
+                fs::remove(temporary, ec);
+                return false;
+            }
+        }
+        fs::rename(temporary, filename, ec);
+        if (ec) fs::remove(temporary, ec);
+        return !ec;
+    }
+
+    bool const QcnScanner::Items(qcn_items_type& items)
+    {
+        qcn_item_type item;
+        while (Next(item))
+        {
+            items.push_back(item);
+        }
+        return !failed_;
+    }
+
+    bool const QcnScanner::Scan(qcn_items_type& items)
+    {
+        return Headers() && Items(items);
+    }
+
+    bool const QcnScanner::Starts(
+        char const* p, 
+        char const* end, 
+        bool const headers
+    )
+    {
+        // An item starts with a line of the form "NNNNN (0xXXXX) - STATUS".
+        // Rows of item data may start with digits but never continue with
+        // an opening parenthesis on the same line, and never hold a '['
+
+        char const* q = p;
+        if (headers)
+        {
+            while (q != end && (*q == ' ' || *q == '\t')) ++q;
+            if (q != end && *q == '[') return true;
+            q = p;
+        }
+
+        while (q != end && *q >= '0' && *q <= '9') ++q;
+        if (q == p) return false;
+
+        while (q != end && (*q == ' ' || *q == '\t')) ++q;
+        return end - q >= 3 && q[0] == '(' && q[1] == '0' && q[2] == 'x';
+    }
+
+    char const* QcnScanner::FindItem(
+        char const* p, 
+        char const* end, 
+        bool const headers
+    )
+    {
+        while (p != end)
+        {
+            p = std::find(p, end, '\n');
+            if (p == end) break;
+
+            if (Starts(++p, end, headers)) return p;
+        }
+        return end;
+    }
+
+    bool const QcnStream::Open()
+    {
+        if (!opened_)
+        {
+            if (!file_.Open())
+            {
+                err_ = file_.ErrorMessage();
+                return false;
+            }
+            if (file_.begin() == file_.end())
+            {
+                err_ = "Empty input file";
+                return false;
+            }
+            if (!Ordered())
+            {
+                err_ = "Items not in ascending order";
+                return false;
+            }
+            opened_ = true;
+        }
+
+        arena_.clear();
+        scanner_.reset(new QcnScanner(file_.begin(), file_.end(), arena_));
+        scanner_->SetFilter(filter_);
+        current_ = false;
+        failed_ = false;
+
+        if (!scanner_->Headers())
+        {
+            err_ = "Invalid format input file";
+            return false;
+        }
+        Next();
+        if (failed_) err_ = "Invalid format input file";
+        return !failed_;
+    }
+
+    void QcnStream::Next()
+    {
+        // Only the current item's payload is kept in the arena. An item 
+        // out of order fails here too, in case the check in Ordered was 
+        // misled by the layout of the file
+
+        uint const last = item_.code;
+        bool const first = !current_;
+
+        arena_.clear();
+        current_ = scanner_->Next(item_);
+
+        if (scanner_->Failed() || (current_ && !first && item_.code <= last))
+        {
+            current_ = false;
+            failed_ = true;
+        }
+    }
+
+    bool const QcnStream::Ordered() const
+    {
+        // Item lines are found without parsing the data between them, so 
+        // the order can be checked before anything has been compared
+
+        char const* const end = file_.end();
+        bool first = true;
+        uint last = 0;
+
+        for (char const* p = QcnScanner::FindItem(file_.begin(), end); 
+             p != end; 
+             p = QcnScanner::FindItem(p, end))
+        {
+            uint code = 0;
+            for (char const* q = p; q != end && q - p < 9 && *q >= '0' && *q <= '9'; ++q)
+            {
+                code = code * 10 + (*q - '0');
+            }
+            if (!first && code <= last) return false;
+
+            last = code;
+            first = false;
+        }
+        return true;
+    }
+
+    bool const Qcn::ParseChunks(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        // Split the items at item boundaries into chunks of at least 1MB, 
+        // one per thread, and parse them concurrently into separate arenas.
+        // Any failure rejects the lot and the caller parses serially, so 
+        // errors are exactly those of the serial parser
+
+        static std::size_t const minimum = 1 << 20;
+
+        QcnScanner s(begin, end, *arena_);
+        if (!s.Headers()) return false;
+
+        char const* first = s.Position();
+        std::size_t const n = std::min<std::size_t>(
+            threads_, (end - first) / minimum
+        );
+        if (n < 2) return false;
+
+        std::vector<char const*> bounds(1, first);
+        for (std::size_t i = 1; i < n; i++)
+        {
+            char const* p = QcnScanner::FindItem(first + (end - first) * i / n, end);
+            if (p != end && p > bounds.back()) bounds.push_back(p);
+        }
+        bounds.push_back(end);
+
+        std::size_t const chunks = bounds.size() - 1;
+        std::vector<qcn_items_type> items(chunks);
+        std::vector<qcn_arena_type> arenas(chunks);
+        std::vector<char> ok(chunks, false);
+
+        // Headers part way through change the item size, so each chunk 
+        // starts in the section of the last header line before it
+
+        uint size = s.ItemSize();
+        bool open = s.Variable();
+        std::vector<uint> sizes(1, size);
+        std::vector<char> variable(1, open);
+        qcn_arena_type scratch;
+
+        for (char const* q = std::find(first, end, '['); q != end; )
+        {
+            char const* p = q;
+            while (p != first && (p[-1] == ' ' || p[-1] == '\t')) --p;
+
+            if (p == first || p[-1] == '\n' || p[-1] == '\r')
+            {
+                while (sizes.size() < chunks && bounds[sizes.size()] <= q)
+                {
+                    sizes.push_back(size);
+                    variable.push_back(open);
+                }
+                QcnScanner h(q, end, scratch, size, open);
+                if (!h.Headers()) return false;
+
+                size = h.ItemSize();
+                open = h.Variable();
+                q = h.Position();
+            }
+            else
+            {
+                ++q;
+            }
+            q = std::find(q, end, '[');
+        }
+        sizes.resize(chunks, size);
+        variable.resize(chunks, open);
+
+        auto parse = [&](std::size_t const i) {
+            try
+            {
+                QcnScanner c(
+                    bounds[i], bounds[i + 1], arenas[i], sizes[i], variable[i]
+                );
+                c.SetFilter(filter_);
+                ok[i] = c.Items(items[i]);
+            }
+            catch (std::exception const&)
+            {
+                ok[i] = false;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < chunks; i++)
+        {
+            threads.push_back(std::thread(parse, i));
+        }
+        parse(0);
+
+        for (auto i = threads.begin(); i != threads.end(); ++i)
+        {
+            i->join();
+        }
+        if (std::count(ok.begin(), ok.end(), false)) return false;
+
+        // Concatenate the chunks, moving each item's payload reference from
+        // its chunk arena into the file arena
+
+        std::size_t total = 0, count = 0;
+        for (std::size_t i = 0; i < chunks; i++)
+        {
+            total += arenas[i].size();
+            count += items[i].size();
+        }
+        arena_->reserve(total);
+        data.reserve(count);
+
+        for (std::size_t i = 0; i < chunks; i++)
+        {
+            uint const base = arena_->size();
+            arena_->insert(arena_->end(), arenas[i].begin(), arenas[i].end());
+
+            for (auto j = items[i].begin(); j != items[i].end(); ++j)
+            {
+                j->data = qcn_item_data_type(
+                    arena_.get(), base + j->data.offset(), j->data.size()
+                );
+                data.push_back(*j);
+            }
+        }
+        return true;
+    }
+
+    bool const Qcn::Parse(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        return Load(begin, end, data, false);
+    }
+
+    bool const Qcn::ParseCompressed(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        return Load(begin, end, data, true);
+    }
+
+    bool const Qcn::Load(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data,
+        bool const compressed
+    )
+    {
+        // The cache of a compressed input is keyed on its compressed bytes,
+        // so that loading from the cache needs no decompression. A copy 
+        // shares the arena it was made with, whose payloads are left to it
+
+        arena_ = std::make_shared<qcn_arena_type>();
+
+        bool const binary = CompoundFile::Detect(begin, end);
+
+        if (!cache_ || Filename() == "-")
+        {
+            return compressed ? ParseStream(begin, end, data) 
+                : binary ? ParseBinary(begin, end, data)
+                : ParseText(begin, end, data);
+        }
+
+        std::string const index = Filename() + ".qcnidx";
+        uint64_t const size = end - begin;
+        uint64_t const hash = Fnv1a(begin, end);
+
+        if (LoadIndex(index, size, hash, data))
+        {
+            return true;
+        }
+        data.clear();
+        arena_->clear();
+
+        if (compressed ? !ParseStream(begin, end, data) 
+            : binary ? !ParseBinary(begin, end, data)
+            : !ParseText(begin, end, data))
+        {
+            return false;
+        }
+        if (!filter_) SaveIndex(index, size, hash, data);
+        return true;
+    }
+
+    bool const Qcn::LoadIndex(
+        std::string const& filename,
+        uint64_t const size,
+        uint64_t const hash,
+        qcn_items_type& data
+    )
+    {
+        namespace fs = boost::filesystem;
+        namespace ipc = boost::interprocess;
+
+        boost::system::error_code ec;
+        std::time_t const mtime = fs::last_write_time(Filename(), ec);
+
+        if (ec || !fs::is_regular_file(filename, ec)
+            || fs::file_size(filename, ec) < sizeof(index_header))
+        {
+            return false;
+        }
+
+        ipc::mapped_region region;
+        try
+        {
+            ipc::file_mapping f(filename.c_str(), ipc::read_only);
+            ipc::mapped_region r(f, ipc::read_only);
+            region.swap(r);
+        }
+        catch (ipc::interprocess_exception const&)
+        {
+            return false;
+        }
+
+        char const* p = static_cast<char const*>(region.get_address());
+        uint64_t const length = region.get_size();
+
+        index_header h;
+        std::memcpy(&h, p, sizeof(h));
+
+        if (std::memcmp(h.magic, index_magic, sizeof(h.magic)) != 0
+            || h.order != index_order
+            || h.size != size
+            || h.mtime != static_cast<int64_t>(mtime)
+            || h.hash != hash
+            || length != sizeof(h) + h.items * sizeof(index_item) + h.bytes)
+        {
+            return false;
+        }
+
+        index_item const* items = 
+            reinterpret_cast<index_item const*>(p + sizeof(h));
+        uint8_t const* bytes = 
+            reinterpret_cast<uint8_t const*>(items + h.items);
+
+        arena_->assign(bytes, bytes + h.bytes);
+        data.reserve(h.items);
+
+        for (uint i = 0; i < h.items; i++)
+        {
+            index_item const& e = items[i];
+            if (e.status >= status_missing
+                || uint64_t(e.offset) + e.size > h.bytes)
+            {
+                return false;
+            }
+
+            if (filter_ && !filter_->Accepts(e.code)) continue;
+
+            qcn_item_type item;
+            item.code = e.code;
+            item.status = static_cast<qcn_status_type>(e.status);
+            item.data = qcn_item_data_type(arena_.get(), e.offset, e.size);
+            data.push_back(item);
+        }
+        return true;
+    }
+
+    void Qcn::SaveIndex(
+        std::string const& filename,
+        uint64_t const size,
+        uint64_t const hash,
+        qcn_items_type const& data
+    ) const
+    {
+        // The index is written under a temporary name of its own, so that 
+        // runs saving the same index at once do not write into each other's
+        // file, and renamed into place so that a reader never sees a partial
+        // file. Failure to write it is not an error; the input simply gets 
+        // parsed again next time
+
+        namespace fs = boost::filesystem;
+
+        boost::system::error_code ec;
+        std::time_t const mtime = fs::last_write_time(Filename(), ec);
+        if (ec) return;
+
+        index_header h;
+        std::memcpy(h.magic, index_magic, sizeof(h.magic));
+        h.order = index_order;
+        h.items = data.size();
+        h.size = size;
+        h.mtime = mtime;
+        h.hash = hash;
+        h.bytes = arena_->size();
+
+        std::vector<index_item> items;
+        items.reserve(data.size());
+
+        for (auto i = data.begin(); i != data.end(); ++i)
+        {
+            index_item e;
+            e.code = i->code;
+            e.status = i->status;
+            e.offset = i->data.offset();
+            e.size = i->data.size();
+            items.push_back(e);
+        }
+
+        std::string const temporary = fs::unique_path(
+            filename + ".%%%%-%%%%-%%%%.tmp", ec
+        ).string();
+        if (ec) return;
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+            out.write(
+                reinterpret_cast<char const*>(items.data()), 
+                items.size() * sizeof(index_item)
+            );
+            out.write(
+                reinterpret_cast<char const*>(arena_->data()), 
+                arena_->size()
+            );
+            if (!out.good())
+            {
+                out.close();
+                fs::remove(temporary, ec);
+                return;
+            }
+        }
+        fs::rename(temporary, filename, ec);
+        if (ec) fs::remove(temporary, ec);
+    }
+
+    bool const Qcn::ParseText(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        if (threads_ > 1 && ParseChunks(begin, end, data))
+        {
+            return true;
+        }
+        data.clear();
+        arena_->clear();
+
+        QcnScanner s(begin, end, *arena_);
+        s.SetFilter(filter_);
+        if (s.Scan(data))
+        {
+            return true;
+        }
+        data.clear();
+        arena_->clear();
+
+        // Let the grammar decide, then move its output into the arena. The
+        // grammar accepts hex values of any width but payloads are bytes
+
+        qcn_raw_items_type raw;
+        if (!ParseGrammar(begin, end, raw))
+        {
+            return false;
+        }
+        
+        for (auto i = raw.begin(); i != raw.end(); ++i)
+        {
+            if (filter_ && !filter_->Accepts(i->code)) continue;
+
+            qcn_item_type item;
+            uint const offset = arena_->size();
+
+            for (auto j = i->data.begin(); j != i->data.end(); ++j)
+            {
+                if (*j > 0xFF)
+                {
+                    data.clear();
+                    return false;
+                }
+                arena_->push_back(static_cast<uint8_t>(*j));
+            }
+            item.code = i->code;
+            item.status = static_cast<qcn_status_type>(std::find(
+                statuses, statuses + status_missing, i->status
+            ) - statuses);
+            item.data = qcn_item_data_type(
+                arena_.get(), offset, i->data.size()
+            );
+            data.push_back(item);
+        }
+        return true;
+    }
+
+    bool const CompoundFile::Detect(char const* begin, char const* end)
+    {
+        return end - begin >= 8 
+            && std::equal(compound_magic, compound_magic + 8, begin);
+    }
+
+    bool const CompoundFile::Open()
+    {
+        // The header takes the first sector. Sector n starts n + 1 sectors
+        // into the file, and the sectors of the allocation table (FAT) are
+        // listed by the DIFAT: 109 entries in the header, then a chain of 
+        // sectors of further entries
+
+        if (!Detect(begin_, end_) || end_ - begin_ < 512) return false;
+
+        shift_ = ReadLE16(begin_ + 0x1E);
+        mini_shift_ = ReadLE16(begin_ + 0x20);
+        if ((shift_ != 9 && shift_ != 12) || mini_shift_ != 6) return false;
+
+        std::size_t const size = std::size_t(1) << shift_;
+        if (uint64_t(end_ - begin_) < 2 * size) return false;
+
+        std::size_t const per = size / 4;
+        uint32_t const fat_sectors = ReadLE32(begin_ + 0x2C);
+        uint32_t const directory = ReadLE32(begin_ + 0x30);
+        uint32_t const mini_fat = ReadLE32(begin_ + 0x3C);
+        uint32_t next = ReadLE32(begin_ + 0x44);
+        uint32_t const more = ReadLE32(begin_ + 0x48);
+        uint64_t const sectors = (end_ - begin_) / size - 1;
+
+        cutoff_ = ReadLE32(begin_ + 0x38);
+        if (fat_sectors > sectors) return false;
+
+        // The DIFAT chain is followed no further than the FAT sectors it 
+        // has to list, and never through a sector twice
+
+        chain_type difat;
+        for (uint i = 0; i < 109; i++)
+        {
+            difat.push_back(ReadLE32(begin_ + 0x4C + 4 * i));
+        }
+
+        std::vector<bool> seen(sectors);
+        uint64_t const chained = std::min<uint64_t>(more, sectors);
+
+        for (uint64_t i = 0; i < chained && difat.size() < fat_sectors; i++)
+        {
+            if (next >= sectors || seen[next]) return false;
+            seen[next] = true;
+
+            char const* const p = begin_ + (uint64_t(next) + 1) * size;
+            for (std::size_t j = 0; j + 1 < per; j++)
+            {
+                difat.push_back(ReadLE32(p + 4 * j));
+            }
+            next = ReadLE32(p + size - 4);
+        }
+        if (difat.size() < fat_sectors) return false;
+
+        fat_.clear();
+        fat_.reserve(uint64_t(fat_sectors) * per);
+        for (uint32_t i = 0; i < fat_sectors; i++)
+        {
+            if (difat[i] >= sectors) return false;
+
+            char const* const p = begin_ + (uint64_t(difat[i]) + 1) * size;
+            for (std::size_t j = 0; j < per; j++)
+            {
+                fat_.push_back(ReadLE32(p + 4 * j));
+            }
+        }
+
+        // The directory is a chain of 128 byte entries, the first of them 
+        // the root, whose stream holds the small streams in 64 byte mini 
+        // sectors with an allocation table of their own
+
+        chain_type chain;
+        std::vector<char> bytes;
+        if (!Chain(fat_, directory, chain) || !Sectors(chain, bytes)) 
+        {
+            return false;
+        }
+
+        entries_.clear();
+        for (std::size_t i = 0; i + 128 <= bytes.size(); i += 128)
+        {
+            char const* const p = bytes.data() + i;
+            entry e;
+            
+            uint const length = std::min<uint>(ReadLE16(p + 0x40), 64);
+            for (uint j = 0; j + 2 < length; j += 2)
+            {
+                uint32_t const ch = ReadLE16(p + j);
+                e.name.push_back(ch < 0x80 ? char(ch) : '?');
+            }
+            e.type = uint8_t(p[0x42]);
+            e.left = ReadLE32(p + 0x44);
+            e.right = ReadLE32(p + 0x48);
+            e.child = ReadLE32(p + 0x4C);
+            e.start = ReadLE32(p + 0x74);
+            e.size = shift_ == 9 ? ReadLE32(p + 0x78) : ReadLE64(p + 0x78);
+            entries_.push_back(e);
+        }
+        if (entries_.empty() || entries_[0].type != 5) return false;
+
+        mini_stream_.clear();
+        mini_fat_.clear();
+        
+        if (entries_[0].start != compound_end)
+        {
+            chain.clear();
+            if (!Chain(fat_, entries_[0].start, chain) 
+                || !Sectors(chain, mini_stream_)
+                || mini_stream_.size() < entries_[0].size)
+            {
+                return false;
+            }
+            mini_stream_.resize(entries_[0].size);
+
+            chain.clear();
+            bytes.clear();
+            if (!Chain(fat_, mini_fat, chain) || !Sectors(chain, bytes)) 
+            {
+                return false;
+            }
+            for (std::size_t i = 0; i + 4 <= bytes.size(); i += 4)
+            {
+                mini_fat_.push_back(ReadLE32(bytes.data() + i));
+            }
+        }
+        return true;
+    }
+
+    bool const CompoundFile::Read(
+        std::string const& storage, 
+        std::string const& stream, 
+        std::vector<char>& out
+    ) const
+    {
+        for (uint32_t i = 0; i < entries_.size(); i++)
+        {
+            if ((entries_[i].type == 1 || entries_[i].type == 5) 
+                && SameName(entries_[i].name, storage))
+            {
+                uint32_t const j = Find(i, stream);
+                if (j != compound_none && entries_[j].type == 2)
+                {
+                    return Stream(entries_[j], out);
+                }
+            }
+        }
+        return false;
+    }
+
+    bool const CompoundFile::Chain(
+        chain_type const& table, 
+        uint32_t sector, 
+        chain_type& chain
+    ) const
+    {
+        // A chain longer than the table must loop back on itself
+
+        for (; sector != compound_end; sector = table[sector])
+        {
+            if (sector >= table.size() || chain.size() >= table.size()) 
+            {
+                return false;
+            }
+            chain.push_back(sector);
+        }
+        return true;
+    }
+
+    bool const CompoundFile::Sectors(
+        chain_type const& chain, 
+        std::vector<char>& out
+    ) const
+    {
+        std::size_t const size = std::size_t(1) << shift_;
+        uint64_t const length = end_ - begin_;
+        uint64_t const sectors = length >= 2 * size ? length / size - 1 : 0;
+
+        out.reserve(out.size() + chain.size() * size);
+        for (auto i = chain.begin(); i != chain.end(); ++i)
+        {
+            if (*i >= sectors) return false;
+
+            char const* const p = begin_ + (uint64_t(*i) + 1) * size;
+            out.insert(out.end(), p, p + size);
+        }
+        return true;
+    }
+
+    bool const CompoundFile::Stream(
+        entry const& e, 
+        std::vector<char>& out
+    ) const
+    {
+        chain_type chain;
+        out.clear();
+
+        if (e.size >= cutoff_)
+        {
+            if (!Chain(fat_, e.start, chain) || !Sectors(chain, out)) 
+            {
+                return false;
+            }
+        }
+        else
+        {
+            std::size_t const size = std::size_t(1) << mini_shift_;
+
+            if (!Chain(mini_fat_, e.start, chain)) return false;
+
+            out.reserve(chain.size() * size);
+            for (auto i = chain.begin(); i != chain.end(); ++i)
+            {
+                std::size_t const offset = std::size_t(*i) * size;
+                if (offset + size > mini_stream_.size()) return false;
+
+                out.insert(
+                    out.end(), 
+                    mini_stream_.begin() + offset, 
+                    mini_stream_.begin() + offset + size
+                );
+            }
+        }
+        if (out.size() < e.size) return false;
+
+        out.resize(e.size);
+        return true;
+    }
+
+    uint32_t const CompoundFile::Find(
+        uint32_t const storage, 
+        std::string const& name
+    ) const
+    {
+        // The entries of a storage form a tree through their left and 
+        // right links, hung from the storage's child link
+
+        std::vector<uint32_t> pending(1, entries_[storage].child);
+        std::size_t visited = 0;
+
+        while (!pending.empty() && visited++ <= entries_.size())
+        {
+            uint32_t const i = pending.back();
+            pending.pop_back();
+
+            if (i >= entries_.size()) continue;
+            if (SameName(entries_[i].name, name)) return i;
+
+            pending.push_back(entries_[i].left);
+            pending.push_back(entries_[i].right);
+        }
+        return compound_none;
+    }
+
+    bool const Qcn::ParseBinary(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        // A binary .qcn holds the numbered NV items in the stream 
+        // NV_ITEM_ARRAY of the storage NV_NUMBERED_ITEMS, as records of a 
+        // little endian 16 bit stream index, the 16 bit item code and the
+        // 128 bytes of the item. Only items that could be read are saved,
+        // so every item is OK. The layout has not been checked against a
+        // backup from a phone, so a stream of any other record size is 
+        // reported as such rather than read
+
+        static std::size_t const header = 4;
+        static std::size_t const size = 128;
+        static std::size_t const record = header + size;
+
+        CompoundFile document(begin, end);
+        std::vector<char> items;
+
+        if (!document.Open())
+        {
+            SetError("Invalid compound document in binary file");
+            return false;
+        }
+        if (!document.Read("NV_NUMBERED_ITEMS", "NV_ITEM_ARRAY", items))
+        {
+            SetError("No NV_ITEM_ARRAY stream in binary file");
+            return false;
+        }
+        if (items.size() % record != 0)
+        {
+            SetError(
+                "NV_ITEM_ARRAY of " + std::to_string(items.size()) 
+                + " bytes is not made of 132 byte records"
+            );
+            return false;
+        }
+
+        std::size_t const count = items.size() / record;
+        arena_->resize(count * size);
+        data.reserve(count);
+
+        char const* const last = items.data() + items.size();
+        uint offset = 0;
+
+        for (char const* p = items.data(); p != last; p += record)
+        {
+            qcn_item_type item;
+            item.code = ReadLE16(p + 2);
+            if (filter_ && !filter_->Accepts(item.code)) continue;
+
+            std::memcpy(arena_->data() + offset, p + header, size);
+            item.status = status_ok;
+            item.data = qcn_item_data_type(arena_.get(), offset, size);
+            data.push_back(item);
+            offset += size;
+        }
+        arena_->resize(offset);
+        return true;
+    }
+
+    bool const Qcn::ParseStream(
+        char const* begin, 
+        char const* end, 
+        qcn_items_type& data
+    )
+    {
+        // Parse the output as the decompressor delivers it, a run of whole
+        // items at a time. A run ends where the last complete item line in
+        // the output so far begins, and the rest waits for the next run. 
+        // The output is kept, so that should the scanner fail the rest is
+        // added to it and the whole is parsed again as text, with errors 
+        // and the grammar fallback as for text
+
+        Decompressor d(begin, end);
+        std::string text;
+        std::size_t done = 0;
+        std::size_t search = 0;
+        uint size = 0;
+        bool open = false;
+        bool started = false;
+        bool ok = true;
+        bool more = true;
+
+        while (ok && more)
+        {
+            more = d.Read(text);
+
+            // A compressed binary file has to be decompressed whole
+
+            if (!started 
+                && CompoundFile::Detect(text.data(), text.data() + text.size()))
+            {
+                while (d.Read(text));
+                if (d.Failed()) break;
+
+                return ParseBinary(text.data(), text.data() + text.size(), data);
+            }
+
+            char const* const first = text.data() + done;
+            char const* cut = text.data() + text.size();
+
+            if (more)
+            {
+                char const* const limit = text.data() + text.rfind('\n') + 1;
+                if (limit <= first) continue;
+
+                cut = first;
+                for (char const* p = first + search; 
+                     (p = QcnScanner::FindItem(p, limit)) != limit; )
+                {
+                    cut = p;
+                }
+                search = limit - first - 1;
+                if (cut == first) continue;
+            }
+            else if (d.Failed())
+            {
+                break;
+            }
+
+            QcnScanner s(first, cut, *arena_, size, open);
+            s.SetFilter(filter_);
+            ok = (started || s.Headers()) && s.Items(data);
+
+            started = true;
+            size = s.ItemSize();
+            open = s.Variable();
+            done += cut - first;
+            search = search > std::size_t(cut - first) 
+                ? search - (cut - first) 
+                : 0;
+        }
+        if (ok && !d.Failed()) return true;
+
+        while (d.Read(text));
+        if (d.Failed())
+        {
+            SetError(d.ErrorMessage());
+            return false;
+        }
+
+        data.clear();
+        arena_->clear();
+        return ParseText(text.data(), text.data() + text.size(), data);
+    }
+
+    bool const IgnoreRules::Open(std::string const& filename)
+    {
+        // A byte rule may name at most this many codes and byte offsets,
+        // and the masks of all the rules may hold at most this many words
+
+        static uint64_t const most = 1 << 16;
+        uint64_t words = 0;
+
+        InputFile in(filename);
+        if (!in.Open())
+        {
+            err_ = in.ErrorMessage();
+            return false;
+        }
+
+        char const* p = in.begin();
+        char const* const end = in.end();
+        uint line = 0;
+
+        while (p != end)
+        {
+            char const* eol = std::find(p, end, '\n');
+            std::string text(p, std::find(p, eol, '#'));
+            p = eol == end ? end : eol + 1;
+            line++;
+
+            std::istringstream rule(text);
+            std::string keyword, codes, rest;
+            rule >> keyword;
+            if (keyword.empty()) continue;
+
+            rule >> codes;
+            std::getline(rule, rest);
+            rest.erase(0, rest.find_first_not_of(" \t"));
+            rest.erase(rest.find_last_not_of(" \t\r") + 1);
+
+            bool valid = false;
+            CodeFilter c, b;
+
+            if (!rest.empty() && keyword != "bytes") codes += ' ' + rest;
+
+            if (keyword == "code")
+            {
+                valid = items_.Add(codes);
+            }
+            else if (keyword == "category")
+            {
+                valid = !codes.empty();
+                if (valid) categories_.push_back(codes);
+            }
+            else if (keyword == "bytes" && c.Add(codes) && b.Add(rest))
+            {
+                uint64_t n = 0;
+                for (auto i = c.Ranges().begin(); i != c.Ranges().end(); ++i)
+                {
+                    n += uint64_t(i->second) - i->first + 1;
+                }
+                valid = n <= most && b.Ranges().back().second < most;
+
+                qcn_mask_type rule;
+                for (auto j = b.Ranges().begin(); valid && j != b.Ranges().end(); ++j)
+                {
+                    rule.resize(j->second / 64 + 1);
+                    for (uint k = j->first; k <= j->second; k++)
+                    {
+                        rule[k / 64] |= 1ULL << (k % 64);
+                    }
+                }
+
+                // Codes with no mask yet take that of the rule, and codes 
+                // with one take its union with the rule, made once for all
+                // the codes that shared it
+
+                std::map<uint, uint> merged;
+                uint const own = uint(masks_.size());
+
+                for (auto i = c.Ranges().begin(); valid && i != c.Ranges().end(); ++i)
+                {
+                    for (uint64_t code = i->first; valid && code <= i->second; code++)
+                    {
+                        auto const found = bytes_.find(uint(code));
+                        uint const old = found != bytes_.end() ? found->second : own;
+                        auto const m = merged.find(old);
+
+                        if (m != merged.end())
+                        {
+                            bytes_[uint(code)] = m->second;
+                            continue;
+                        }
+
+                        qcn_mask_type mask = rule;
+                        if (old != own)
+                        {
+                            qcn_mask_type const& o = masks_[old];
+                            if (mask.size() < o.size()) mask.resize(o.size());
+                            for (std::size_t w = 0; w < o.size(); w++) 
+                            {
+                                mask[w] |= o[w];
+                            }
+                        }
+                        words += mask.size();
+                        valid = words <= most;
+
+                        merged[old] = uint(masks_.size());
+                        bytes_[uint(code)] = uint(masks_.size());
+                        masks_.push_back(std::move(mask));
+                    }
+                }
+            }
+
+            if (!valid)
+            {
+                err_ = "Invalid rule at line " + std::to_string(line);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool const IgnoreRules::Apply(uint const code, qcn_mask_type& mask) const
+    {
+        auto const i = bytes_.find(code);
+        qcn_mask_type const* ignored = i != bytes_.end() ? &masks_[i->second] : 0;
+        uint64_t any = 0;
+
+        for (std::size_t w = 0; w < mask.size(); w++)
+        {
+            if (ignored && w < ignored->size()) mask[w] &= ~(*ignored)[w];
+            any |= mask[w];
+        }
+        return any != 0;
+    }
+
+    bool const DiffBytes(
+        qcn_item_data_type const& lhs,
+        qcn_item_data_type const& rhs,
+        qcn_mask_type& mask
+    )
+    {
+        uint const n = std::min(lhs.size(), rhs.size());
+        uint const size = std::max(lhs.size(), rhs.size());
+        uint8_t const* l = lhs.begin();
+        uint8_t const* r = rhs.begin();
+        uint64_t any = 0;
+        uint i = 0;
+
+        mask.assign((size + 63) / 64, 0);
+
+#ifdef QCN_SSE2
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i const a = 
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i));
+            __m128i const b = 
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i));
+
+            uint64_t const m = 
+                ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+
+            mask[i / 64] |= m << (i % 64);
+            any |= m;
+        }
+
+#endif
+
+        for (; i < size; i++)
+        {
+            if (i >= n || l[i] != r[i])
+            {
+                mask[i / 64] |= 1ULL << (i % 64);
+                any = 1;
+            }
+        }
+        return any != 0;
+    }
+
+    diff_ref_type const CompareRefs(
+        Qcn const& lhs, 
+        Qcn const& rhs, 
+        Qcn::cmp const cmp,
+        IgnoreRules const* ignore
+    )
+    {
+        diff_ref_type d;
+        CompareEach(
+            lhs, rhs, cmp, [&d](qref const& q) { d.push_back(q); }, ignore
+        );
+        return d;
+    }
+
+    diff_type const Compare(
+        Qcn const& lhs, 
+        Qcn const& rhs, 
+        Qcn::cmp const cmp,
+        IgnoreRules const* ignore
+    )
+    {
+        auto const refs = CompareRefs(lhs, rhs, cmp, ignore);
+
+        diff_type d;
+        d.reserve(refs.size());
+
+        for (auto i = refs.begin(); i != refs.end(); ++i)
+        {
+            d.push_back(qdiff(i->Left(), i->Right(), i->mask));
         }
         return d;
     }
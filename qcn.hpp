@@ -22,6 +22,16 @@ Copyright 2014 dl12345@xda-developers forum
 #include <iomanip>
 #include <fstream>
 #include <iterator>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
 #include <boost/config/warning_disable.hpp>
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/home/classic/iterator/file_iterator.hpp>
@@ -29,6 +39,8 @@ Copyright 2014 dl12345@xda-developers forum
 #include <boost/spirit/include/phoenix.hpp>
 #include <boost/fusion/include/adapt_struct.hpp>
 #include <boost/iterator/iterator_adaptor.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/utility/string_ref.hpp>
 
 
 namespace qcn
@@ -41,48 +53,483 @@ namespace qcn
     namespace phx = boost::phoenix;
 
     class Dictionary;
+    class NvTable;
     class Qcn;
     
     struct qitem;    
+    struct qraw;
+    struct qdiff;
+    struct qref;
     struct dict_code;
+    struct dict_entry;
     
+    template <typename T_value> class CodeTable;
+    class CodeFilter;
+    class IgnoreRules;
+
     typedef unsigned int uint;
     
     // Skipper type for parser
     typedef ascii::space_type space_type;
 
     // item grammar types
+    typedef struct qraw qcn_raw_item_type;
+    typedef std::vector<qcn_raw_item_type> qcn_raw_items_type;
+    typedef std::vector< uint > qcn_raw_data_type;
+
+    // Status of an item, in the order of the statuses in a qcn file. The 
+    // empty item, standing for one missing from a file, is status_missing
+
+    typedef enum {
+        status_ok, 
+        status_inactive, 
+        status_bad, 
+        status_denied, 
+        status_missing
+    } qcn_status_type;
+
+    // item types
     typedef struct qitem qcn_item_type;
     typedef std::vector<qcn_item_type> qcn_items_type;  
-    typedef std::vector< uint > qcn_item_data_type;    
-    typedef boost::unordered_map<uint, qcn_item_type> qcn_map_type;   
+    typedef class qbytes qcn_item_data_type;    
+    typedef std::vector< uint8_t > qcn_arena_type;
+    typedef CodeTable<qcn_item_type> qcn_map_type;   
         
     // dictionary grammar types
     typedef struct dict_code dict_code_type;
     typedef std::vector<dict_code_type> dict_codes_type; 
-    typedef boost::unordered_map<uint, dict_code_type> dict_map_type;
+    typedef CodeTable<dict_code_type> dict_map_type;
     
     // comparison type pairs
     typedef std::pair<qcn_item_type, qcn_item_type> pair_type;
-    typedef std::vector<pair_type> diff_type;
+    typedef std::vector< uint64_t > qcn_mask_type;
+    typedef std::vector<qdiff> diff_type;
+    typedef std::vector<qref> diff_ref_type;
     
     
-    struct qitem
+    typedef enum {
+        compression_none, 
+        compression_gzip, 
+        compression_zstd
+    } compression_type;
+
+    // Read only view of an input file. Regular files are memory mapped so
+    // that the parsers run directly over the file contents without copying.
+    // Pipes, devices and stdin (given as "-") are read into a buffer instead.
+    // Compressed files are decompressed into the buffer as they are opened,
+    // unless expand is false, when the view is of the compressed bytes
+
+    class InputFile
+    {
+    public:
+
+        InputFile(std::string const& filename, bool const expand = true)
+            :   filename_(filename),
+                begin_(0),
+                end_(0),
+                mapped_(false),
+                expand_(expand)
+        {
+        }
+
+        bool const Open();
+        std::string const& ErrorMessage() const { return err_; }
+
+        char const* begin() const { return begin_; }
+        char const* end() const { return end_; }
+        bool const IsMapped() const { return mapped_; }
+
+    private:
+
+        InputFile(InputFile const&);
+        InputFile& operator=(InputFile const&);
+
+        bool const Expand();
+
+        std::string filename_;
+        std::string err_;
+        boost::interprocess::mapped_region region_;
+        std::string buffer_;
+        char const* begin_;
+        char const* end_;
+        bool mapped_;
+        bool expand_;
+    };
+
+    // Decompressor of a gzip or zstd input on a thread of its own. Output
+    // passes to the reader through a ring of fixed size blocks, so the 
+    // reader can work on each block while the next is being decompressed
+    // and no more than the ring is held at once
+
+    class Decompressor
+    {
+    public:
+
+        Decompressor(char const* begin, char const* end);
+        ~Decompressor();
+
+        // Append the next block of output to out, waiting for it if need 
+        // be. Returns false once the output is exhausted or has failed
+
+        bool const Read(std::string& out);
+        bool const Failed() const { return failed_; }
+        std::string const& ErrorMessage() const { return err_; }
+
+        // Format of the input from its leading magic bytes
+
+        static compression_type const Detect(
+                                                char const* begin, 
+                                                char const* end
+                                            );
+
+        // Whether this build can decompress the format. zstd needs the 
+        // build to be made with ZSTD=1
+
+        static bool const Supports(compression_type const format);
+
+    private:
+
+        Decompressor(Decompressor const&);
+        Decompressor& operator=(Decompressor const&);
+
+        void Run();
+        void Gzip();
+        void Zstd();
+        char* Acquire();
+        void Publish(std::size_t const size, bool const last);
+        void Fail(std::string const& err);
+
+        static std::size_t const block_size = 1 << 18;
+        static std::size_t const blocks = 8;
+
+        char const* begin_;
+        char const* end_;
+        std::vector< std::vector<char> > ring_;
+        std::vector<std::size_t> sizes_;
+        std::size_t head_;
+        std::size_t count_;
+        std::mutex mutex_;
+        std::condition_variable filled_;
+        std::condition_variable emptied_;
+        std::string err_;
+        bool done_;
+        bool failed_;
+        bool stop_;
+        std::thread thread_;
+    };
+
+    // Reader of the streams of an OLE compound document, the container of
+    // binary .qcn backups, over a view of the whole file. Streams are 
+    // found by name and by the name of the storage holding them, wherever
+    // that storage is in the document
+
+    class CompoundFile
+    {
+    public:
+
+        CompoundFile(char const* begin, char const* end)
+            :   begin_(begin),
+                end_(end),
+                shift_(0),
+                mini_shift_(0),
+                cutoff_(0)
+        {
+        }
+
+        bool const Open();
+
+        // Contents of the first stream named stream in a storage named 
+        // storage, the names compared without regard to case
+
+        bool const Read(
+                            std::string const& storage, 
+                            std::string const& stream, 
+                            std::vector<char>& out
+                        ) const;
+
+        // Whether the view starts with the compound document signature
+
+        static bool const Detect(char const* begin, char const* end);
+
+    private:
+
+        typedef std::vector<uint32_t> chain_type;
+
+        struct entry
+        {
+            std::string name;
+            uint type;
+            uint32_t left;
+            uint32_t right;
+            uint32_t child;
+            uint32_t start;
+            uint64_t size;
+        };
+
+        bool const Chain(
+                            chain_type const& table, 
+                            uint32_t sector, 
+                            chain_type& chain
+                        ) const;
+        bool const Sectors(
+                            chain_type const& chain, 
+                            std::vector<char>& out
+                        ) const;
+        bool const Stream(entry const& e, std::vector<char>& out) const;
+        uint32_t const Find(
+                                uint32_t const storage, 
+                                std::string const& name
+                            ) const;
+
+        char const* begin_;
+        char const* end_;
+        uint shift_;
+        uint mini_shift_;
+        uint32_t cutoff_;
+        chain_type fat_;
+        chain_type mini_fat_;
+        std::vector<char> mini_stream_;
+        std::vector<entry> entries_;
+    };
+
+    // Item payload. The payloads of all the items of a file are stored one
+    // after the other in a single arena owned by the Qcn, and an item refers
+    // to its bytes by offset and length. The arena is addressed through the
+    // vector rather than its buffer so that it may grow while parsing
+
+    class qbytes
+    {
+    public:
+
+        typedef uint8_t const* const_iterator;
+
+        qbytes(): arena_(0), offset_(0), size_(0) {}
+
+        qbytes(qcn_arena_type const* arena, uint const offset, uint const size)
+            :   arena_(arena),
+                offset_(offset),
+                size_(size)
+        {
+        }
+
+        const_iterator begin() const 
+        { 
+            return arena_ ? arena_->data() + offset_ : 0; 
+        }
+
+        const_iterator end() const { return begin() + size_; }
+        uint const offset() const { return offset_; }
+        uint const size() const { return size_; }
+        bool const empty() const { return size_ == 0; }
+        uint8_t const operator[](uint const i) const { return begin()[i]; }
+
+        bool operator==(qbytes const& rhs) const
+        {
+            return size_ == rhs.size_ 
+                && (size_ == 0 || std::memcmp(begin(), rhs.begin(), size_) == 0);
+        }
+
+        bool operator!=(qbytes const& rhs) const { return !(*this == rhs); }
+
+    private:
+
+        qcn_arena_type const* arena_;
+        uint offset_;
+        uint size_;
+    };
+
+    // Item as produced by the grammar, before its payload is moved into the
+    // arena
+
+    struct qraw
     {
         uint code;
-        std::string description;
-        std::string category;
         std::string status;
-        qcn_item_data_type data;
+        qcn_raw_data_type data;
+    };
+
+    // Fixed number of threads running tasks in the order they are queued.
+    // Tasks still queued when the pool is destroyed are abandoned; the pool
+    // waits only for those already running
+
+    class WorkerPool
+    {
+    public:
+
+        typedef std::function<void()> task_type;
+
+        WorkerPool(uint const threads);
+        ~WorkerPool();
+
+        std::future<void> Run(task_type const& task);
+        uint const Size() const { return threads_.size(); }
+
+        // Number of threads to use when none is specified
 
-        qitem(): code(0) {}
+        static uint const DefaultSize();
+
+    private:
+
+        WorkerPool(WorkerPool const&);
+        WorkerPool& operator=(WorkerPool const&);
+
+        void Work();
+
+        std::vector<std::thread> threads_;
+        std::deque< std::function<void()> > queue_;
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        bool stop_;
+    };
+
+    // Wall and CPU time spent in a stage, in seconds. The CPU time is that 
+    // of the thread that ran the stage
+
+    struct stage_time
+    {
+        double wall;
+        double cpu;
+
+        stage_time() : wall(0), cpu(0) {}
+    };
+
+    // Adds the time from its construction to its destruction to a stage. 
+    // Given no stage it reads no clocks, so that code can be timed at no 
+    // cost when statistics are not wanted
+
+    class StageTimer
+    {
+    public:
+
+        StageTimer(stage_time* stage) : stage_(stage), wall_(0), cpu_(0)
+        {
+            if (stage_)
+            {
+                wall_ = Wall();
+                cpu_ = ThreadCpu();
+            }
+        }
+
+        ~StageTimer()
+        {
+            if (stage_)
+            {
+                stage_->wall += Wall() - wall_;
+                stage_->cpu += ThreadCpu() - cpu_;
+            }
+        }
+
+        static double const Wall();
+        static double const ThreadCpu();
+        static double const ProcessCpu();
+
+    private:
 
-        qitem(struct qitem const& c)
-            : code(c.code), status(c.status), data(c.data) {}
+        StageTimer(StageTimer const&);
+        StageTimer& operator=(StageTimer const&);
+
+        stage_time* stage_;
+        double wall_;
+        double cpu_;
+    };
+
+    // What loading a file took: mapping or reading it, parsing it and 
+    // building its hash table, with the size of the table
+
+    struct load_stats
+    {
+        stage_time read;
+        stage_time parse;
+        stage_time index;
+        uint64_t bytes;
+        uint64_t items;
+        uint64_t buckets;
+        double load_factor;
+
+        load_stats() : bytes(0), items(0), buckets(0), load_factor(0) {}
+    };
+
+    // Peak resident memory of the process in kB
+
+    uint64_t const PeakRss();
+
+    // Report text formatted into a large buffer that is written to the 
+    // stream in big blocks, without the stream formatting or flushing each
+    // line. Hex digits are taken from a table of all the byte values
+
+    class ReportWriter
+    {
+    public:
+
+        ReportWriter(std::ostream& o, std::size_t const capacity = 1 << 20)
+            :   o_(o),
+                buffer_(capacity),
+                used_(0)
+        {
+        }
+
+        ~ReportWriter() { Flush(); }
+
+        ReportWriter& operator<<(char const c)
+        {
+            if (used_ == buffer_.size()) Flush();
+            buffer_[used_++] = c;
+            return *this;
+        }
+
+        ReportWriter& operator<<(char const* s) { return Write(s, std::strlen(s)); }
+        ReportWriter& operator<<(std::string const& s) { return Write(s.data(), s.size()); }
+        ReportWriter& operator<<(boost::string_ref const s) { return Write(s.data(), s.size()); }
+
+        ReportWriter& Write(char const* s, std::size_t const n);
+
+        // Numbers padded on the left to at least width characters
+
+        ReportWriter& Decimal(uint64_t v, uint const width = 0, char const fill = '0');
+        ReportWriter& Hex(uint64_t v, uint const width = 0);
+        ReportWriter& Byte(uint8_t const v);
+
+        // An item as printed by operator<<, and the hex rows of its payload
+
+        ReportWriter& Item(qcn_item_type const& q);
+        ReportWriter& Rows(qcn_item_data_type const& data);
+
+        void Flush();
+
+    private:
+
+        ReportWriter(ReportWriter const&);
+        ReportWriter& operator=(ReportWriter const&);
+
+        char* Reserve(std::size_t const n);
+
+        std::ostream& o_;
+        std::vector<char> buffer_;
+        std::size_t used_;
+    };
+
+    // Text of a status as written in a qcn file, or "Missing"
+
+    char const* const StatusText(qcn_status_type const status);
+
+    // An item refers to its payload in the arena of its file, and to its
+    // description and category, when set, in the dictionary they came from
+
+    struct qitem
+    {
+        uint code;
+        qcn_status_type status;
+        boost::string_ref description;
+        boost::string_ref category;
+        qcn_item_data_type data;
+
+        qitem(): code(0), status(status_missing) {}
 
         bool operator==(struct qitem const& rhs) const
         {
-            if (code == 0 && status.empty()) // the empty object doesn't match
+            // the empty object doesn't match
+
+            if (code == 0 && status == status_missing)
             {
                 return false;
             }
@@ -95,7 +542,7 @@ namespace qcn
         
         bool operator!=(struct qitem const& rhs) const
         {
-            if (code == 0 && status.empty())
+            if (code == 0 && status == status_missing)
             {
                 return true;
             }
@@ -108,50 +555,96 @@ namespace qcn
     
         friend std::ostream& operator<<(std::ostream& o, struct qitem const& q)
         {
-            o << std::setw(4) << std::setfill('0');
-            o << std::dec << q.code;
-            
-            if (!q.description.empty())
-            {
-                o << " (" << q.description << ", " << q.category;
-            }
-            else
-            {
-                o << " (0x";
-                o << std::setw(4) << std::setfill('0');
-                o << std::uppercase << std::hex << q.code;
-            }
-            o << ") - " << (q.status == "" ? "Missing" : q.status) << std::endl;
-
-            for (auto i = 0; i < q.data.size(); i++)
-            {
-                if (i && i % 16 == 0) 
-                {
-                    std::cout << std::endl;
-                }
-                else if (i) o << " ";
-
-                o << std::setw(2) << std::setfill('0');
-                o << std::uppercase << std::hex << q.data[i];
-            }
-            if(q.data.size() > 0) o << std::endl;
+            ReportWriter(o, 256).Item(q);
             return o;
         }
 
     };  
 
+    // A pair of non matching items together with a bitmask of the payload
+    // offsets at which they differ. Bit i of the mask is word i / 64, bit 
+    // i % 64; offsets past the end of the shorter payload are set. The mask
+    // is empty when an item is missing from either file. The items are 
+    // copies, but their payloads are not (see Compare)
+
+    struct qdiff : public pair_type
+    {
+        qcn_mask_type mask;
+
+        qdiff(
+                qcn_item_type const& lhs, 
+                qcn_item_type const& rhs, 
+                qcn_mask_type const& m = qcn_mask_type()
+            )
+            : pair_type(lhs, rhs), mask(m) {}
+
+        bool const Differs(uint const i) const
+        {
+            return i / 64 < mask.size() && (mask[i / 64] >> (i % 64)) & 1;
+        }
+    };
+
+    // Non owning form of qdiff that refers to the items inside the two Qcn
+    // objects compared, which must outlive it. An item missing from one of
+    // the files is flagged rather than represented by an empty item
+
+    struct qref
+    {
+        typedef enum {none, left, right} side;
+
+        qcn_item_type const* lhs;
+        qcn_item_type const* rhs;
+        side missing;
+        qcn_mask_type mask;
+
+        qref(
+                qcn_item_type const* l, 
+                qcn_item_type const* r,
+                qcn_mask_type const& m = qcn_mask_type()
+            )
+            :   lhs(l), 
+                rhs(r), 
+                missing(l ? (r ? none : right) : left), 
+                mask(m) 
+        {
+        }
+
+        // The items on either side; a missing item is the empty item
+
+        qcn_item_type const& Left() const { return lhs ? *lhs : Empty(); }
+        qcn_item_type const& Right() const { return rhs ? *rhs : Empty(); }
+
+        // The code of the item, whichever side it is present on
+
+        uint const Code() const { return lhs ? lhs->code : rhs->code; }
+
+        bool const Differs(uint const i) const
+        {
+            return i / 64 < mask.size() && (mask[i / 64] >> (i % 64)) & 1;
+        }
+
+        static qcn_item_type const& Empty()
+        {
+            static qcn_item_type const empty;
+            return empty;
+        }
+    };
+
     template < typename Iterator, typename Skipper = space_type >
-    class qcnparser : public qi::grammar< Iterator, qcn_items_type(), Skipper > 
+    class qcnparser 
+        : public qi::grammar< Iterator, qcn_raw_items_type(), Skipper > 
     {        
     public:
 
         // qcn grammar types
         typedef uint code_type;
         typedef std::vector< uint > leaf_type;
-        typedef fusion::vector2< std::string, uint > size_type;
-        typedef fusion::vector2< size_type, size_type > info_type;
         
-        qcnparser() : qcnparser::base_type(qcndata), size_(0)
+        qcnparser() 
+            :   qcnparser::base_type(qcndata), 
+                size_(0), 
+                length_(0), 
+                variable_(false)
         {
 
             using qi::uint_;
@@ -168,33 +661,38 @@ namespace qcn
             using qi::_1;
             using qi::attr;
             using qi::eps;
+            using qi::lexeme;
+            using qi::xdigit;
             using phx::ref;           
+
+            // A file is a run of sections, each opened by one or more 
+            // headers. A header either declares the item size of the 
+            // section, which holds until the next such header, or is a 
+            // label such as [NV items] that leaves it unchanged
            
-            qcndata = omit[+(header)] >> *(item);
+            qcndata = omit[+(header)] >> *(item) >> omit[*(header)];
 
             header = '[' >> description >> ']';
 
-            description = nvitemslabel | iteminfo; 
+            description = iteminfo | sectionlabel; 
 
-            nvitemslabel = lit("NV items") ;
+            sectionlabel = lexeme[+(char_ - ']' - eol)];
 
             iteminfo = itemnumber >> ',' >> itemsize;
             
-            itemnumber = string("Complete items") >> '-' >> uint_;
+            itemnumber = lit("Complete items") >> '-' >> uint_;
 
-            // In the presence of a semantic action the % operator is 
-            // necessary to ensure the propagation of the attribute if
-            // _val is not assigned explicitly
+            itemsize = lit("Items size") >> '-' 
+                        >> (uint_[ref(size_)=_1, ref(variable_)=false]
+                            | lit("variable")[ref(variable_)=true]);
 
-            itemsize %= (string("Items size") >> '-' >> uint_[ref(size_)=_1]);        
-
-            item = itempresent | itemnotpresent;
+            item = omit[*(header)] >> (itempresent | itemnotpresent);
 
             itempresent = itemcode >> statusok >> itemdata;
 
             itemnotpresent = itemcode                                
                                 >> statusother
-                                >> attr(qcn_item_data_type());
+                                >> attr(qcn_raw_data_type());
 
             itemcode = ulong_ >> omit [ itemdiscard ];
 
@@ -206,13 +704,24 @@ namespace qcn
                         | string("Parameter bad")
                         | string("Access denied"));
 
-            // Rules separated to allow for semantic action on data if desired
+            // The payload of an item is either prefixed with its length, 
+            // as in "00010 (0x000A) - OK - 3", or takes the item size of 
+            // its section. In a section of variable size the payload is a 
+            // run of two digit bytes ending at the next item or header
+
+            itemdata = sizedleaf 
+                        | (eps(!ref(variable_)) >> itemleaf) 
+                        | (eps(ref(variable_)) >> openleaf);
 
-            // For example
-            // omit[eps] >> itemleaf[_val=convert(_1, qcn_item_data_type())];
+            sizedleaf = omit['-' >> uint_[ref(length_)=_1]] 
+                        >> repeat(ref(length_))[hex];
 
-            itemdata = omit[eps] >> itemleaf;
             itemleaf = repeat(ref(size_))[hex];
+
+            openleaf = *(openbyte);
+
+            openbyte = lexeme[uint_parser<uint, 16, 2, 2>() >> !xdigit] 
+                        >> !lit('(');
     
 #ifdef BOOST_SPIRIT_DEBUG
 
@@ -224,33 +733,173 @@ namespace qcn
 
         }
     private:
-        qi::rule<Iterator, qcn_items_type(), Skipper> qcndata; 
+        qi::rule<Iterator, qcn_raw_items_type(), Skipper> qcndata; 
 
-        qi::rule<Iterator, info_type(), Skipper>  header; 
-        qi::rule<Iterator, info_type(), Skipper> description;
+        qi::rule<Iterator, Skipper> header; 
+        qi::rule<Iterator, Skipper> description;
 
-        qi::rule<Iterator, Skipper> nvitemslabel;
-        qi::rule<Iterator, info_type(), Skipper> iteminfo;
+        qi::rule<Iterator, Skipper> sectionlabel;
+        qi::rule<Iterator, Skipper> iteminfo;
 
-        qi::rule<Iterator, size_type(), Skipper> itemnumber;
-        qi::rule<Iterator, size_type(), Skipper> itemsize; 
+        qi::rule<Iterator, Skipper> itemnumber;
+        qi::rule<Iterator, Skipper> itemsize; 
 
-        qi::rule<Iterator, qcn_item_type(), Skipper> item;
-        qi::rule<Iterator, qcn_item_type(), Skipper> itempresent;
-        qi::rule<Iterator, qcn_item_type(), Skipper> itemnotpresent; 
+        qi::rule<Iterator, qcn_raw_item_type(), Skipper> item;
+        qi::rule<Iterator, qcn_raw_item_type(), Skipper> itempresent;
+        qi::rule<Iterator, qcn_raw_item_type(), Skipper> itemnotpresent; 
 
         qi::rule<Iterator, std::string(), Skipper> statusok;
         qi::rule<Iterator, std::string(), Skipper> statusother;
 
         qi::rule<Iterator, code_type(), Skipper> itemcode;
         qi::rule<Iterator, Skipper> itemdiscard;
-        qi::rule<Iterator, qcn_item_data_type(), Skipper> itemdata;
+        qi::rule<Iterator, qcn_raw_data_type(), Skipper> itemdata;
         qi::rule<Iterator, leaf_type(), Skipper> itemleaf;
+        qi::rule<Iterator, leaf_type(), Skipper> sizedleaf;
+        qi::rule<Iterator, leaf_type(), Skipper> openleaf;
+        qi::rule<Iterator, uint(), Skipper> openbyte;
         
         unsigned int size_;
+        unsigned int length_;
+        bool variable_;
     
     }; 
     
+    // Set of codes, held as ranges, that restricts the items read from a 
+    // file. Items whose codes are not in the set are passed over by the 
+    // parsers without their payloads being read
+
+    class CodeFilter
+    {
+    public:
+
+        void Add(uint const first, uint const last);
+
+        // Add ranges written as in "1000-2000,6828". Returns false, adding
+        // nothing, if they are not well formed
+
+        bool const Add(std::string const& ranges);
+
+        bool const Accepts(uint const code) const
+        {
+            auto const i = std::upper_bound(
+                ranges_.begin(), 
+                ranges_.end(), 
+                std::make_pair(code, ~0u)
+            );
+            return i != ranges_.begin() && code <= (i - 1)->second;
+        }
+
+        bool const Empty() const { return ranges_.empty(); }
+
+        // disjoint ranges of first and last code, in ascending order
+
+        std::vector< std::pair<uint, uint> > const& Ranges() const 
+        { 
+            return ranges_; 
+        }
+
+    private:
+
+        std::vector< std::pair<uint, uint> > ranges_;
+    };
+
+    // Hand written parser for the qcn text format used on the hot path in
+    // place of qcnparser. It accepts a subset of the language qcnparser
+    // accepts and produces identical items, appending their payloads to the
+    // arena. On any input it does not handle it fails, and the caller 
+    // falls back to the grammar, which then decides whether the input is 
+    // valid. Rows of item data in the canonical QPST layout are decoded 16
+    // bytes at a time with SSE2 where available
+
+    class QcnScanner
+    {
+    public:
+
+        QcnScanner(char const* begin, char const* end, qcn_arena_type& arena)
+            :   p_(begin),
+                end_(end),
+                arena_(arena),
+                filter_(0),
+                size_(0),
+                variable_(false),
+                failed_(false)
+        {
+        }
+
+        // Scanner for a run of items that starts after the headers, given 
+        // the item size the headers declared
+
+        QcnScanner(
+                    char const* begin, 
+                    char const* end, 
+                    qcn_arena_type& arena, 
+                    uint const size,
+                    bool const variable = false
+                )
+            :   p_(begin),
+                end_(end),
+                arena_(arena),
+                filter_(0),
+                size_(size),
+                variable_(variable),
+                failed_(false)
+        {
+        }
+
+        bool const Headers();
+        bool const Next(qcn_item_type& item);
+        bool const Items(qcn_items_type& items);
+        bool const Scan(qcn_items_type& items);
+        bool const Failed() const { return failed_; }
+
+        char const* Position() const { return p_; }
+        uint const ItemSize() const { return size_; }
+        bool const Variable() const { return variable_; }
+
+        // Pass over the items whose codes filter does not accept, or none 
+        // if it is null
+
+        void SetFilter(CodeFilter const* filter) { filter_ = filter; }
+
+        // Start of the first line after p that begins an item, or with 
+        // headers an item or a header, or end if there is none
+
+        static char const* FindItem(
+                                        char const* p, 
+                                        char const* end, 
+                                        bool const headers = false
+                                    );
+
+    private:
+
+        void Skip();
+        bool const Literal(char const* s);
+        bool const Decimal(uint& value);
+        bool const Hex(uint& value);
+        bool const Header();
+        bool const Leaf(qcn_item_data_type& data, uint const size);
+        bool const OpenLeaf(qcn_item_data_type& data);
+        bool const ByteEnds(char const* q) const;
+        bool const Pass();
+
+        // Whether the line at p starts an item, or with headers a header
+
+        static bool const Starts(
+                                    char const* p, 
+                                    char const* end, 
+                                    bool const headers
+                                );
+
+        char const* p_;
+        char const* end_;
+        qcn_arena_type& arena_;
+        CodeFilter const* filter_;
+        uint size_;
+        bool variable_;
+        bool failed_;
+    };
+
     struct dict_code
     {
 
@@ -318,6 +967,107 @@ namespace qcn
         qi::rule<Iterator, std::string(), Skipper> category;
     };            
     
+    // Map from code to value for the small, dense codes of nv items. The 
+    // values are held in one vector in the order they were inserted, which
+    // is also the order of iteration, and found through a table indexed by
+    // code, with a hash map for the few codes too large for the table. As 
+    // with a vector, an insertion beyond the reserved capacity invalidates
+    // references to the values
+
+    template <typename T_value>
+    class CodeTable
+    {
+    public:
+
+        typedef uint key_type;
+        typedef T_value mapped_type;
+        typedef std::pair<uint, T_value> value_type;
+        typedef typename std::vector<value_type>::iterator iterator;
+        typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+        // Codes below dense are found in the table, at 4 bytes per code up
+        // to the largest code inserted
+
+        static uint const dense = 1 << 16;
+
+        iterator begin() { return values_.begin(); }
+        iterator end() { return values_.end(); }
+        const_iterator begin() const { return values_.begin(); }
+        const_iterator end() const { return values_.end(); }
+
+        std::size_t const size() const { return values_.size(); }
+        bool const empty() const { return values_.empty(); }
+
+        std::size_t const bucket_count() const 
+        { 
+            return slots_.size() + sparse_.bucket_count(); 
+        }
+
+        float const load_factor() const
+        {
+            return bucket_count() ? float(size()) / bucket_count() : 0;
+        }
+
+        void reserve(std::size_t const n) { values_.reserve(n); }
+
+        void clear()
+        {
+            slots_.clear();
+            sparse_.clear();
+            values_.clear();
+        }
+
+        iterator find(uint const code)
+        {
+            uint const i = Slot(code);
+            return i ? values_.begin() + (i - 1) : values_.end();
+        }
+
+        const_iterator find(uint const code) const
+        {
+            uint const i = Slot(code);
+            return i ? values_.begin() + (i - 1) : values_.end();
+        }
+
+        T_value& operator[](uint const code)
+        {
+            uint i = Slot(code);
+            if (!i)
+            {
+                values_.push_back(value_type(code, T_value()));
+                i = values_.size();
+
+                if (code < dense)
+                {
+                    if (code >= slots_.size()) slots_.resize(code + 1);
+                    slots_[code] = i;
+                }
+                else
+                {
+                    sparse_[code] = i;
+                }
+            }
+            return values_[i - 1].second;
+        }
+
+    private:
+
+        // One more than the index of the value for code, or 0 if none
+
+        uint const Slot(uint const code) const
+        {
+            if (code < slots_.size()) return slots_[code];
+            if (code < dense || sparse_.empty()) return 0;
+
+            auto const i = sparse_.find(code);
+            return i == sparse_.end() ? 0 : i->second;
+        }
+
+        std::vector<uint> slots_;
+        boost::unordered_map<uint, uint> sparse_;
+        std::vector<value_type> values_;
+    };
+
     template <
                 typename T_data_type, 
                 typename T_item_type,
@@ -331,11 +1081,13 @@ namespace qcn
         typedef typename T_data_type::iterator d_iterator;
         typedef typename T_map_type::iterator m_iterator;
         typedef typename T_map_type::const_iterator m_const_iterator;
+        typedef std::vector<T_item_type const*> ordered_type;
         
         DataFile(std::string const& filename)
             :   filename_(filename), 
                 err_(""),
-                success_(false)
+                success_(false),
+                stats_(0)
         {
         }
 
@@ -343,31 +1095,34 @@ namespace qcn
             :   filename_(rhs.filename_), 
                 err_(rhs.err_),
                 success_(rhs.success_),
+                stats_(0),
                 map_(rhs.map_)  
         {
+            MakeIndex();
         }
  
         ~DataFile() {}
          
         bool const Open()
         {
-            using spirit::ascii::space;    
-            using qi::eoi;
-            using qi::blank;
-   
-            std::ifstream in(filename_);  
-            if (!in.is_open()) 
+            InputFile in(filename_, false);
+            bool opened;
             {
-                err_ = "Could not open input file";
+                StageTimer t(stats_ ? &stats_->read : 0);
+                opened = in.Open();
+            }
+            err_.clear();
+            if (!opened)
+            {
+                err_ = in.ErrorMessage();
                 success_ = false;
                 return success_;
             }
-            in.unsetf(std::ios::skipws);
 
-            typedef spirit::istream_iterator iterator_type;
+            typedef char const* iterator_type;
             
-            iterator_type begin(in);
-            iterator_type end;
+            iterator_type begin = in.begin();
+            iterator_type end = in.end();
 
             if (begin == end)
             {
@@ -376,18 +1131,41 @@ namespace qcn
                 return success_;
             }
 
-            T_parser_type p;   
-            bool r = phrase_parse(begin, end, p >> eoi, space, data_);    
+            compression_type const format = Decompressor::Detect(begin, end);
 
-            if (r && begin == end)
+            if (!Decompressor::Supports(format))
             {
-                MakeHashTable();
+                err_ = "Compressed in a format this build cannot read";
+                success_ = false;
+                return success_;
+            }
+
+            bool parsed;
+            {
+                StageTimer t(stats_ ? &stats_->parse : 0);
+                parsed = format == compression_none
+                    ? Parse(begin, end, data_)
+                    : ParseCompressed(begin, end, data_);
+            }
+            if (parsed)
+            {
+                {
+                    StageTimer t(stats_ ? &stats_->index : 0);
+                    MakeHashTable();
+                }
+                if (stats_)
+                {
+                    stats_->bytes = end - begin;
+                    stats_->items = map_.size();
+                    stats_->buckets = map_.bucket_count();
+                    stats_->load_factor = map_.load_factor();
+                }
                 success_ = true;            
                 return success_;
             }
             else
             {
-                err_ = "Invalid format input file";
+                if (err_.empty()) err_ = "Invalid format input file";
                 success_ = false;
                 return success_;
             } 
@@ -397,6 +1175,10 @@ namespace qcn
         bool const IsOpen() const { return success_; }
         uint const Size() const { return map_.size(); }
         std::string const& ErrorMessage() { return err_; }
+
+        // Record what Open takes in stats, or nothing if null
+
+        void SetStats(load_stats* stats) { stats_ = stats; }
         
     public:
 
@@ -482,6 +1264,65 @@ namespace qcn
         iterator Find(uint const& key) { return map_.find(key); }
         const_iterator Find(uint const& key) const { return map_.find(key); }
 
+        // All items in ascending order of key
+
+        ordered_type const& Sorted() const { return ordered_; }
+
+    protected:
+
+        std::string const& Filename() const { return filename_; }
+
+        // Parse the whole of the input into data
+
+        virtual bool const Parse(
+                                    char const* begin, 
+                                    char const* end, 
+                                    T_data_type& data
+                                ) = 0;
+
+        // Parse the whole of a compressed input into data. Unless a derived
+        // class can do better, the input is decompressed whole and parsed
+
+        virtual bool const ParseCompressed(
+                                            char const* begin, 
+                                            char const* end, 
+                                            T_data_type& data
+                                        )
+        {
+            Decompressor d(begin, end);
+            std::string text;
+
+            while (d.Read(text));
+            if (d.Failed())
+            {
+                SetError(d.ErrorMessage());
+                return false;
+            }
+            return Parse(text.data(), text.data() + text.size(), data);
+        }
+
+        // Give the reason a parse failed, in place of an invalid format
+
+        void SetError(std::string const& err) { err_ = err; }
+
+        // Parse the whole of the input with the grammar. The attribute need
+        // not be T_data_type, which lets a derived class post process the
+        // grammar's output
+
+        template <typename T_attr_type>
+        bool const ParseGrammar(
+                                    char const* begin, 
+                                    char const* end, 
+                                    T_attr_type& attr
+                                )
+        {
+            using spirit::ascii::space;    
+            using qi::eoi;
+
+            T_parser_type p;   
+            bool r = phrase_parse(begin, end, p >> eoi, space, attr);    
+            return r && begin == end;
+        }
 
     private:
     
@@ -489,25 +1330,64 @@ namespace qcn
           
         void MakeHashTable()
         {
+            // Files normally list their items in ascending order, in which
+            // case the ordered index is built as the items are inserted. 
+            // Otherwise, or if a key repeats, it is sorted afterwards. Room
+            // is reserved for every item so that the index stays valid
+
+            bool sorted = true;
+            ordered_.clear();
+            map_.reserve(data_.size());
+
             for (auto i = data_.begin(); i != data_.end(); ++i)
             {
-                map_[Key(i)] = *i;
+                sorted = sorted && (i == data_.begin() || Key(i - 1) < Key(i));
+
+                T_item_type& item = map_[Key(i)];
+                item = *i;
+                ordered_.push_back(&item);
             }
             data_.clear();
+
+            if (!sorted) MakeIndex();
+        }
+
+        void MakeIndex()
+        {
+            typedef typename T_map_type::value_type const* value_type;
+            
+            std::vector<value_type> v;
+            v.reserve(map_.size());
+
+            for (auto i = map_.begin(); i != map_.end(); ++i)
+            {
+                v.push_back(&*i);
+            }
+            std::sort(v.begin(), v.end(), [](value_type a, value_type b) {
+                return a->first < b->first;
+            });
+
+            ordered_.clear();
+            for (auto i = v.begin(); i != v.end(); ++i)
+            {
+                ordered_.push_back(&(*i)->second);
+            }
         }
             
         std::string filename_;
         std::string err_;
         bool success_;
+        load_stats* stats_;
         T_data_type data_;
         T_map_type map_;
+        ordered_type ordered_;
     };
                       
     class Dictionary: public DataFile   < 
                                             dict_codes_type, 
                                             dict_code_type,
                                             dict_map_type, 
-                                            codeparser<spirit::istream_iterator> 
+                                            codeparser<char const*> 
                                         > 
     {
     public:
@@ -515,6 +1395,16 @@ namespace qcn
         Dictionary(std::string const& filename) : DataFile(filename) {}
         Dictionary(Dictionary const& rhs) : DataFile(rhs) {}
           
+    protected:
+
+        bool const Parse(
+                            char const* begin, 
+                            char const* end, 
+                            dict_codes_type& data
+                        )
+        {
+            return ParseGrammar(begin, end, data);
+        }
           
     private:
     
@@ -524,12 +1414,87 @@ namespace qcn
         }
         
     };
+
+    // Description and category of a code, referring to the text held by
+    // the NvTable it was found in
+
+    struct dict_entry
+    {
+        boost::string_ref description;
+        boost::string_ref category;
+    };
+
+    // Dictionary compiled into a table indexed directly by code. Open 
+    // accepts either a text dictionary, which is parsed and compiled in 
+    // memory, or a table previously written by Save, which is mapped and 
+    // used as it is without any parsing
+
+    class NvTable
+    {
+    public:
+
+        NvTable(std::string const& filename)
+            :   filename_(filename),
+                file_(filename),
+                begin_(0),
+                codes_(0),
+                sparse_(0),
+                text_(false)
+        {
+        }
+
+        bool const Open();
+        bool const IsOpen() const { return begin_ != 0 || text_; }
+
+        // Read the entries for the given codes only. A text dictionary is 
+        // scanned line by line and only the lines for codes not already 
+        // read are parsed. It may be called again with further codes
+
+        bool const Open(std::vector<uint> const& codes);
+
+        std::string const& ErrorMessage() const { return err_; }
+
+        // The entry refers to text held by the table, which stays valid 
+        // until the next call to Open
+
+        bool const Find(uint const code, dict_entry& entry) const;
+
+        // Codes whose category, ignoring case, is the given one or starts 
+        // with it and a space, so that "RF" selects "RF LTE" and "RF CDMA".
+        // Only the entries read so far are searched, all of them after Open
+
+        std::vector<uint> const Codes(std::string const& category) const;
+        bool const Save(std::string const& filename) const;
+
+        // Entries in the table, or read so far from a text dictionary
+
+        uint const Size() const;
+
+    private:
+
+        NvTable(NvTable const&);
+        NvTable& operator=(NvTable const&);
+
+        bool const Compile(Dictionary const& dict);
+        bool const Load(char const* begin, char const* end);
+
+        std::string filename_;
+        std::string err_;
+        InputFile file_;
+        std::vector<char> table_;
+        char const* begin_;
+        char const* end_;
+        uint codes_;
+        uint sparse_;
+        bool text_;
+        dict_map_type entries_;
+    };
     
     class Qcn: public DataFile  < 
                                     qcn_items_type, 
                                     qcn_item_type,
                                     qcn_map_type, 
-                                    qcnparser< spirit::istream_iterator > 
+                                    qcnparser< char const* > 
                                 > 
     {
     public:
@@ -537,9 +1502,98 @@ namespace qcn
         typedef qcn_item_type item;     
         typedef enum {present, missing, both} cmp;
             
-        Qcn(std::string const& filename) : DataFile(filename) {}
-        Qcn(Qcn const& rhs) : DataFile(rhs) {}
+        Qcn(std::string const& filename) 
+            :   DataFile(filename), 
+                arena_(std::make_shared<qcn_arena_type>()),
+                filter_(0),
+                threads_(1),
+                cache_(false)
+        {
+        }
+
+        Qcn(Qcn const& rhs) 
+            :   DataFile(rhs), 
+                arena_(rhs.arena_), 
+                filter_(rhs.filter_),
+                threads_(rhs.threads_),
+                cache_(rhs.cache_)
+        {
+        }
+
+        // Number of threads Open may use to parse a large file
+
+        void SetThreads(uint const threads) { threads_ = threads; }
+
+        // Whether Open keeps the parsed items in a binary index file next
+        // to the input, named as the input with .qcnidx appended, and loads
+        // them from it instead of parsing while the input is unchanged
+
+        void SetCache(bool const cache) { cache_ = cache; }
+
+        // Read only the items whose codes filter accepts, or all of them 
+        // if it is null. A filtered file is not saved to the cache
+
+        void SetFilter(CodeFilter const* filter) { filter_ = filter; }
                   
+    protected:
+
+        bool const Parse(
+                            char const* begin, 
+                            char const* end, 
+                            qcn_items_type& data
+                        );
+
+        bool const ParseCompressed(
+                                    char const* begin, 
+                                    char const* end, 
+                                    qcn_items_type& data
+                                );
+
+        bool const ParseText(
+                                char const* begin, 
+                                char const* end, 
+                                qcn_items_type& data
+                            );
+
+        bool const ParseStream(
+                                char const* begin, 
+                                char const* end, 
+                                qcn_items_type& data
+                            );
+
+        bool const ParseBinary(
+                                char const* begin, 
+                                char const* end, 
+                                qcn_items_type& data
+                            );
+
+        bool const Load(
+                        char const* begin, 
+                        char const* end, 
+                        qcn_items_type& data,
+                        bool const compressed
+                    );
+
+        bool const LoadIndex(
+                                std::string const& filename,
+                                uint64_t const size,
+                                uint64_t const hash,
+                                qcn_items_type& data
+                            );
+
+        void SaveIndex(
+                        std::string const& filename,
+                        uint64_t const size,
+                        uint64_t const hash,
+                        qcn_items_type const& data
+                    ) const;
+
+        bool const ParseChunks(
+                                char const* begin, 
+                                char const* end, 
+                                qcn_items_type& data
+                            );
+
     private:     
      
         typename qcn_map_type::key_type const Key(d_iterator const& i)
@@ -547,19 +1601,259 @@ namespace qcn
             return i->code;
         }
 
+        std::shared_ptr<qcn_arena_type> arena_;
+        CodeFilter const* filter_;
+        uint threads_;
+        bool cache_;
     };
     
+    // Reader of the items of a file one at a time, holding only the current
+    // item in memory, for comparing files too large to load whole. Only 
+    // files that QcnScanner handles, with their items in strictly ascending
+    // code order, can be read this way; Open fails for any other
+
+    class QcnStream
+    {
+    public:
+
+        QcnStream(std::string const& filename)
+            :   file_(filename),
+                filter_(0),
+                opened_(false),
+                current_(false),
+                failed_(false)
+        {
+        }
+
+        // Open the file, or start again from its first item
+
+        bool const Open();
+        std::string const& ErrorMessage() const { return err_; }
+
+        // Read only the items whose codes filter accepts, from the next Open
+
+        void SetFilter(CodeFilter const* filter) { filter_ = filter; }
+
+        qcn_item_type const* Current() const { return current_ ? &item_ : 0; }
+        void Next();
+        bool const Failed() const { return failed_; }
+
+    private:
+
+        QcnStream(QcnStream const&);
+        QcnStream& operator=(QcnStream const&);
+
+        bool const Ordered() const;
+
+        InputFile file_;
+        std::string err_;
+        qcn_arena_type arena_;
+        std::unique_ptr<QcnScanner> scanner_;
+        CodeFilter const* filter_;
+        qcn_item_type item_;
+        bool opened_;
+        bool current_;
+        bool failed_;
+    };
+
+    // Differences to leave out of comparisons, read from a rules file with
+    // one rule to a line and # starting a comment:
+    //
+    //     code 550,0x1A00-0x1A10     ignore these items altogether
+    //     bytes 6828 0-3,8           ignore these bytes of these items
+    //     category Security          ignore the items in this category
+    //
+    // Each byte rule is compiled into one mask of the ignored bytes, which
+    // the codes of the rule share by index and which is applied only to 
+    // payloads found to differ. Categories are resolved to codes by the 
+    // caller through the dictionary
+
+    class IgnoreRules
+    {
+    public:
+
+        bool const Open(std::string const& filename);
+        std::string const& ErrorMessage() const { return err_; }
+
+        // Categories named by the rules, to be resolved with Ignore
+
+        std::vector<std::string> const& Categories() const 
+        { 
+            return categories_; 
+        }
+
+        void Ignore(uint const first, uint const last) 
+        { 
+            items_.Add(first, last); 
+        }
+
+        bool const Ignores(uint const code) const 
+        { 
+            return items_.Accepts(code); 
+        }
+
+        // Clear the bits of the ignored bytes of code in a mask made by 
+        // DiffBytes. Returns true if any bit is left
+
+        bool const Apply(uint const code, qcn_mask_type& mask) const;
+
+    private:
+
+        CodeFilter items_;
+        CodeTable<uint> bytes_;
+        std::vector<qcn_mask_type> masks_;
+        std::vector<std::string> categories_;
+        std::string err_;
+    };
+
+    // Compare two payloads, setting a bit in mask for each differing byte.
+    // Returns true if any byte differs
+
+    bool const DiffBytes(
+                            qcn_item_data_type const& lhs,
+                            qcn_item_data_type const& rhs,
+                            qcn_mask_type& mask
+                        );
+
+    // Walk two sequences of items in ascending code order as a merge join,
+    // passing each non matching item to visit as it is found, so that 
+    // results can be consumed without being collected first. A sequence
+    // gives its current item, or null at its end, and moves to the next.
+    // The walk stops as soon as either sequence fails, since the items 
+    // of the other could no longer be told apart from missing ones.
+    // Differences that ignore rules out are not passed to visit.
+    // option ::present will perform an inner join of non-matching items
+    // option ::missing will perform an outer join of missing items
+    // option ::both will perform an outer join of all non-matching items
+
+    template <typename T_lhs, typename T_rhs, typename T_visitor>
+    void MergeItems(
+                        T_lhs& lhs, 
+                        T_rhs& rhs, 
+                        Qcn::cmp const cmp,
+                        T_visitor& visit,
+                        IgnoreRules const* ignore
+                    )
+    {
+        qcn_mask_type m;
+
+        for (;;)
+        {
+            if (lhs.Failed() || rhs.Failed()) break;
+
+            qcn_item_type const* l = lhs.Current();
+            qcn_item_type const* r = rhs.Current();
+
+            if (!l && !r) break;
+
+            if (!r || (l && l->code < r->code))
+            {
+                if (cmp != Qcn::cmp::present // left outer join missing items
+                    && !(ignore && ignore->Ignores(l->code)))
+                {
+                    visit(qref(l, 0));
+                }
+                lhs.Next();
+            }
+            else if (!l || r->code < l->code)
+            {
+                if (cmp != Qcn::cmp::present // right outer join missing items
+                    && !(ignore && ignore->Ignores(r->code)))
+                {
+                    visit(qref(0, r));
+                }
+                rhs.Next();
+            }
+            else
+            {
+                if (cmp != Qcn::cmp::missing // inner join
+                    && !(ignore && ignore->Ignores(l->code)))
+                {
+                    bool differs = DiffBytes(l->data, r->data, m);
+                    if (differs && ignore) differs = ignore->Apply(l->code, m);
+
+                    if (differs || l->status != r->status)
+                    {
+                        visit(qref(l, r, m));
+                    }
+                }
+                lhs.Next();
+                rhs.Next();
+            }
+        }
+    }
+
+    // The items of a loaded file in ascending code order, as a sequence 
+    // for MergeItems
+
+    class SortedItems
+    {
+    public:
+
+        SortedItems(Qcn const& q) : i_(q.Sorted().begin()), end_(q.Sorted().end()) {}
+
+        qcn_item_type const* Current() const { return i_ != end_ ? *i_ : 0; }
+        void Next() { ++i_; }
+        bool const Failed() const { return false; }
+
+    private:
+
+        Qcn::ordered_type::const_iterator i_;
+        Qcn::ordered_type::const_iterator end_;
+    };
+
+    template <typename T_visitor>
+    void CompareEach(
+                        Qcn const& lhs, 
+                        Qcn const& rhs, 
+                        Qcn::cmp const cmp,
+                        T_visitor visit,
+                        IgnoreRules const* ignore = 0
+                    )
+    {
+        SortedItems l(lhs), r(rhs);
+        MergeItems(l, r, cmp, visit, ignore);
+    }
+
+    // As CompareEach, reading both files as they are compared. Returns 
+    // false if either file turns out to be invalid part way through
+
+    template <typename T_visitor>
+    bool const CompareStream(
+                                QcnStream& lhs, 
+                                QcnStream& rhs, 
+                                Qcn::cmp const cmp,
+                                T_visitor visit,
+                                IgnoreRules const* ignore = 0
+                            )
+    {
+        MergeItems(lhs, rhs, cmp, visit, ignore);
+        return !lhs.Failed() && !rhs.Failed();
+    }
+
+    diff_ref_type const CompareRefs (
+                                        Qcn const& lhs, 
+                                        Qcn const& rhs, 
+                                        Qcn::cmp const cmp = Qcn::cmp::both,
+                                        IgnoreRules const* ignore = 0
+                                    );
+
+    // As CompareRefs, with the items copied out of lhs and rhs. Only the
+    // items are copied: their payloads still refer to the arena of the 
+    // Qcn they came from, and their descriptions and categories to the 
+    // dictionary, so the result must not outlive either
+
     diff_type const Compare (
                                 Qcn const& lhs, 
                                 Qcn const& rhs, 
-                                Qcn::cmp const cmp = Qcn::cmp::both,        
-                                bool const recurse = true
+                                Qcn::cmp const cmp = Qcn::cmp::both,
+                                IgnoreRules const* ignore = 0
                             );
 
 }
 
 BOOST_FUSION_ADAPT_STRUCT(
-    qcn::qitem,
+    qcn::qraw,
     (qcn::uint, code)
     (std::string, status)
     (std::vector<qcn::uint>, data)
@@ -0,0 +1,110 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/filesystem.hpp>
+#include "qcn.hpp"
+#include "synth.hpp"
+
+namespace fs = boost::filesystem;
+
+int main(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+
+    qcn::synth_options s;
+    std::string base, output;
+
+    std::string prog(fs::path(argv[0]).filename().string());
+    std::string usage = "Usage: " + prog + " [options]";
+
+    po::options_description visible;
+    visible.add_options()
+        ("help,h", "show help message\n")
+        ("items,n", po::value<qcn::uint>(&s.items)->default_value(65536),
+                        "number of items\n")
+        ("size,s", po::value<qcn::uint>(&s.size)->default_value(128),
+                        "payload size of the items with data\n")
+        ("ok", po::value<double>(&s.mix[0])->default_value(1.0),
+                        "weight of items with data\n")
+        ("inactive", po::value<double>(&s.mix[1])->default_value(0.0),
+                        "weight of Inactive item items\n")
+        ("bad", po::value<double>(&s.mix[2])->default_value(0.0),
+                        "weight of Parameter bad items\n")
+        ("denied", po::value<double>(&s.mix[3])->default_value(0.0),
+                        "weight of Access denied items\n")
+        ("seed", po::value<uint64_t>(&s.seed)->default_value(1),
+                        "seed of the items\n")
+        ("variant,v", po::value<uint64_t>(&s.variant)->default_value(0),
+                        "seed of the changes to the items, 0 for none\n")
+        ("mutation,m", po::value<double>(&s.mutation)->default_value(0.01),
+                        "fraction of the items changed by a variant\n")
+        ("base,b", po::value<std::string>(&base),
+                        "change the items of this file instead of\n"
+                        "generating them\n")
+        ("output,o", po::value<std::string>(&output)->default_value("-"),
+                        "output file, - for standard output\n")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, visible), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << std::endl << usage << std::endl << std::endl;
+        std::cout << visible;
+        return 0;
+    }
+
+    std::ofstream file;
+    if (output != "-")
+    {
+        file.open(output, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cerr << output << ": Could not write output file" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& o = output == "-" ? std::cout : file;
+
+    if (base.empty())
+    {
+        qcn::Synthesize(o, s);
+    }
+    else
+    {
+        qcn::Qcn q(base);
+        if (!q.Open())
+        {
+            std::cerr << base << ": " << q.ErrorMessage() << std::endl;
+            return 1;
+        }
+        qcn::Mutate(o, q, s);
+    }
+
+    o.flush();
+    return o.good() ? 0 : 1;
+}
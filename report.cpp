@@ -0,0 +1,487 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#include <string>
+#include <algorithm>
+#include "report.hpp"
+
+// Copy of an item without its payload, for printing the item line alone
+
+qcn::qitem const Header(qcn::qitem const& q)
+{
+    qcn::qitem h(q);
+    h.data = qcn::qcn_item_data_type();
+    return h;
+}
+
+// Print the rows of a pair of payloads that contain differing bytes, showing
+// unchanged bytes as ..
+
+void PrintDelta(qcn::ReportWriter& o, qcn::qref const& p)
+{
+    auto const& l = p.Left().data;
+    auto const& r = p.Right().data;
+    qcn::uint const size = std::max(l.size(), r.size());
+
+    for (qcn::uint row = 0; row < size; row += 16)
+    {
+        bool changed = false;
+        for (qcn::uint i = row; i < row + 16 && i < size; i++)
+        {
+            changed = changed || p.Differs(i);
+        }
+        if (!changed) continue;
+
+        for (int side = 0; side < 2; side++)
+        {
+            auto const& data = side ? r : l;
+
+            o.Hex(row, 4) << (side ? " > " : " < ");
+
+            for (qcn::uint i = row; i < row + 16 && i < size; i++)
+            {
+                if (i > row) o << ' ';
+
+                if (!p.Differs(i))
+                {
+                    o << "..";
+                }
+                else if (i >= data.size())
+                {
+                    o << "--";
+                }
+                else
+                {
+                    o.Byte(data[i]);
+                }
+            }
+            o << '\n';
+        }
+    }
+}
+
+void PrintOutput(
+    qcn::ReportWriter& o,
+    qcn::diff_ref_type const& d, 
+    std::string const& fileone,
+    std::string const& filetwo,
+    qcn::NvTable const* dict,
+    printformat p
+)
+{
+    o << "\nFound ";
+    o.Decimal(d.size()) << " non matching items\n\n";
+    
+    bool const printinfo = dict != 0;
+
+    switch(p)
+    {
+        case interleave:
+
+            for (auto i = d.begin(); i != d.end(); ++i)
+            {
+                qcn::qitem first(i->Left()), second(i->Right());
+                
+                if (printinfo) 
+                {
+                    qcn::dict_entry q;
+                    
+                    if (dict->Find(first.code, q))
+                    {
+                        first.description = q.description;
+                        second.description = q.description;
+                        
+                        first.category = q.category;
+                        second.category = q.category;
+                    }
+                }
+
+                o << '[' << fileone << "]: ";
+                o.Item(first) << '\n';
+
+                o << '[' << filetwo << "]: ";
+                o.Item(second) << '\n';
+            }
+            break;
+
+        case sequential:
+
+            o << '[' << fileone << "]: \n\n"; 
+            for (auto i = d.begin(); i != d.end(); ++i)
+            {
+                o.Item(i->Left()) << '\n';
+            }
+
+            o << '[' << filetwo << "]: \n\n";
+            for (auto i = d.begin(); i != d.end(); ++i)
+            {
+                o.Item(i->Right()) << '\n';
+            }
+            break;
+         
+        case delta:
+
+            for (auto i = d.begin(); i != d.end(); ++i)
+            {
+                qcn::qitem first(Header(i->Left())), second(Header(i->Right()));
+
+                if (printinfo) 
+                {
+                    qcn::dict_entry q;
+                    
+                    if (dict->Find(i->Code(), q))
+                    {
+                        first.description = q.description;
+                        second.description = q.description;
+                        
+                        first.category = q.category;
+                        second.category = q.category;
+                    }
+                }
+
+                // print the item headers only, followed by the changed rows
+
+                o << '[' << fileone << "]: ";
+                o.Item(first);
+                o << '[' << filetwo << "]: ";
+                o.Item(second);
+
+                PrintDelta(o, *i);
+                o << '\n';
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// A text field of a record. JSON strings are escaped; CSV fields are quoted
+// when they contain a separator, a quote or a line break
+
+void PrintField(
+    qcn::ReportWriter& o, 
+    boost::string_ref const s, 
+    printformat const p
+)
+{
+    if (p == json)
+    {
+        o << '"';
+        for (auto i = s.begin(); i != s.end(); ++i)
+        {
+            if (*i == '"' || *i == '\\') 
+            {
+                o << '\\' << *i;
+            }
+            else if (uint8_t(*i) < 0x20)
+            {
+                o << "\\u00";
+                o.Byte(*i);
+            }
+            else
+            {
+                o << *i;
+            }
+        }
+        o << '"';
+    }
+    else if (s.find_first_of(",\"\r\n") != boost::string_ref::npos)
+    {
+        o << '"';
+        for (auto i = s.begin(); i != s.end(); ++i)
+        {
+            if (*i == '"') o << '"';
+            o << *i;
+        }
+        o << '"';
+    }
+    else
+    {
+        o << s;
+    }
+}
+
+void PrintCsvHeader(qcn::ReportWriter& o)
+{
+    o << "base,file,code,description,category,base_status,file_status,";
+    o << "base_data,file_data,offsets\n";
+}
+
+// Print a non matching item as a single JSON or CSV record, with the
+// payloads in hex and the offsets at which they differ. The offsets are
+// empty when the item is missing from either file
+
+void PrintRecord(
+    qcn::ReportWriter& o,
+    qcn::qref const& r,
+    std::string const& fileone,
+    std::string const& filetwo,
+    qcn::NvTable const* dict,
+    printformat const p
+)
+{
+    bool first = true;
+    auto field = [&](char const* name) {
+        if (p == json) o << (first ? "{\"" : ",\"") << name << "\":";
+        else if (!first) o << ',';
+        first = false;
+    };
+
+    qcn::dict_entry e;
+    bool const described = dict && dict->Find(r.Code(), e);
+
+    field("base");
+    PrintField(o, fileone, p);
+    field("file");
+    PrintField(o, filetwo, p);
+    field("code");
+    o.Decimal(r.Code());
+    field("description");
+    if (described) PrintField(o, e.description, p);
+    else if (p == json) o << "null";
+    field("category");
+    if (described) PrintField(o, e.category, p);
+    else if (p == json) o << "null";
+
+    for (int side = 0; side < 2; side++)
+    {
+        qcn::qitem const& q = side ? r.Right() : r.Left();
+        field(side ? "file_status" : "base_status");
+        PrintField(o, qcn::StatusText(q.status), p);
+    }
+
+    for (int side = 0; side < 2; side++)
+    {
+        auto const& data = side ? r.Right().data : r.Left().data;
+        field(side ? "file_data" : "base_data");
+        if (p == json) o << '"';
+        for (qcn::uint i = 0; i < data.size(); i++) o.Byte(data[i]);
+        if (p == json) o << '"';
+    }
+
+    field("offsets");
+    if (p == json) o << '[';
+
+    qcn::uint const size = r.mask.size() * 64;
+    char const* sep = "";
+    for (qcn::uint i = 0; i < size; i++)
+    {
+        if (r.mask[i / 64] == 0)
+        {
+            i += 63;
+        }
+        else if (r.Differs(i))
+        {
+            o << sep;
+            o.Decimal(i);
+            sep = p == json ? "," : " ";
+        }
+    }
+
+    o << (p == json ? "]}\n" : "\n");
+}
+
+// The codes whose descriptions are printed for the differences. The 
+// interleaved format looks up the code of the left hand item, which is 
+// that of the empty item when the item is missing from the baseline
+
+std::vector<qcn::uint> DescribedCodes(qcn::diff_ref_type const& d)
+{
+    std::vector<qcn::uint> codes;
+    for (auto i = d.begin(); i != d.end(); ++i)
+    {
+        codes.push_back(i->Code());
+        codes.push_back(i->Left().code);
+    }
+    return codes;
+}
+
+// Record the differences between the baseline and the file in column file
+// of the summary, out of files columns
+
+void AddSummary(
+    summary_type& summary,
+    qcn::qref const& r,
+    std::size_t const file,
+    std::size_t const files
+)
+{
+    auto j = summary.find(r.Code());
+    if (j == summary.end())
+    {
+        j = summary.insert(std::make_pair(r.Code(), std::string(files, '.'))).first;
+    }
+
+    switch (r.missing)
+    {
+        case qcn::qref::left:
+            j->second[file] = '+';
+            break;
+        case qcn::qref::right:
+            j->second[file] = '-';
+            break;
+        default:
+            j->second[file] = 'X';
+            break;
+    }
+}
+
+void AddSummary(
+    summary_type& summary,
+    qcn::diff_ref_type const& d,
+    std::size_t const file,
+    std::size_t const files
+)
+{
+    for (auto i = d.begin(); i != d.end(); ++i)
+    {
+        AddSummary(summary, *i, file, files);
+    }
+}
+
+void PrintSummary(
+    qcn::ReportWriter& o,
+    summary_type const& summary,
+    files_type const& names,
+    files_type const& errors,
+    qcn::NvTable const* dict
+)
+{
+    o << "\nSummary of ";
+    o.Decimal(names.size() - 1) << " files compared with ";
+    o << names[0] << "\n\n";
+
+    for (std::size_t i = 1; i < names.size(); i++)
+    {
+        o.Decimal(i, 5, ' ') << "  " << names[i];
+        if (!errors[i].empty()) o << " (" << errors[i] << ")";
+        o << '\n';
+    }
+
+    o << "\nX differs, - missing from file, + missing from ";
+    o << names[0] << ", ? file not read\n\n";
+
+    for (auto i = summary.begin(); i != summary.end(); ++i)
+    {
+        std::string row(i->second);
+        for (std::size_t j = 0; j < row.size(); j++)
+        {
+            if (!errors[j + 1].empty()) row[j] = '?';
+        }
+
+        auto const n = std::count_if(
+            row.begin(), 
+            row.end(), 
+            [](char c) { return c != '.' && c != '?'; }
+        );
+
+        o.Decimal(i->first, 5);
+        o.Decimal(n, 6, ' ') << "  " << row;
+
+        if (dict)
+        {
+            qcn::dict_entry j;
+            if (dict->Find(i->first, j))
+            {
+                o << "  " << j.description << ", " << j.category;
+            }
+        }
+        o << '\n';
+    }
+}
+
+// Print a stage as text, or as a JSON object
+
+void PrintStage(
+    std::ostream& o, 
+    char const* name, 
+    qcn::stage_time const& t, 
+    bool const json
+)
+{
+    if (json)
+    {
+        o << '"' << name << "\":{\"wall\":" << t.wall << ",\"cpu\":" << t.cpu << '}';
+    }
+    else
+    {
+        o << "  " << std::left << std::setw(12) << name << std::right;
+        o << std::setw(10) << t.wall << " s wall" << std::setw(10) << t.cpu << " s cpu";
+        o << std::endl;
+    }
+}
+
+void PrintStats(std::ostream& o, run_stats const& s, bool const json)
+{
+    o << std::fixed << std::setprecision(6);
+
+    if (json)
+    {
+        o << "{\"files\":[";
+        for (auto i = s.files.begin(); i != s.files.end(); ++i)
+        {
+            qcn::load_stats const& l = i->load;
+
+            o << (i == s.files.begin() ? "{" : ",{") << "\"name\":\"";
+            for (auto c = i->name.begin(); c != i->name.end(); ++c)
+            {
+                if (*c == '"' || *c == '\\') o << '\\';
+                o << *c;
+            }
+            o << "\",\"bytes\":" << l.bytes << ",\"items\":" << l.items << ',';
+            PrintStage(o, "read", l.read, json);
+            o << ',';
+            PrintStage(o, "parse", l.parse, json);
+            o << ',';
+            PrintStage(o, "index", l.index, json);
+            o << ",\"buckets\":" << l.buckets;
+            o << ",\"load_factor\":" << l.load_factor << '}';
+        }
+        o << "],";
+        PrintStage(o, "dictionary", s.dictionary, json);
+        o << ',';
+        PrintStage(o, "compare", s.compare, json);
+        o << ',';
+        PrintStage(o, "output", s.output, json);
+        o << ',';
+        PrintStage(o, "total", s.total, json);
+        o << ",\"allocations\":" << s.allocations;
+        o << ",\"allocated_bytes\":" << s.allocated;
+        o << ",\"peak_rss_kb\":" << qcn::PeakRss() << '}' << std::endl;
+        return;
+    }
+
+    for (auto i = s.files.begin(); i != s.files.end(); ++i)
+    {
+        qcn::load_stats const& l = i->load;
+
+        o << i->name << ": " << l.bytes << " bytes, " << l.items << " items, ";
+        o << l.buckets << " buckets, load factor " << std::setprecision(2);
+        o << l.load_factor << std::setprecision(6) << std::endl;
+        PrintStage(o, "read", l.read, json);
+        PrintStage(o, "parse", l.parse, json);
+        PrintStage(o, "index", l.index, json);
+    }
+    PrintStage(o, "dictionary", s.dictionary, json);
+    PrintStage(o, "compare", s.compare, json);
+    PrintStage(o, "output", s.output, json);
+    PrintStage(o, "total", s.total, json);
+    o << s.allocations << " allocations, " << s.allocated << " bytes" << std::endl;
+    o << "peak rss " << qcn::PeakRss() << " kB" << std::endl;
+}
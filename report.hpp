@@ -0,0 +1,103 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "qcn.hpp"
+
+typedef enum {interleave, sequential, delta, count, json, csv} printformat;
+typedef std::vector<std::string> files_type;
+
+// For each code that differs in any file, one column per file compared with
+// the baseline holding the kind of difference
+
+typedef std::map<qcn::uint, std::string> summary_type;
+
+// Statistics of a run for --stats. Files that are streamed rather than
+// loaded have no load statistics
+
+struct file_stats
+{
+    std::string name;
+    qcn::load_stats load;
+};
+
+struct run_stats
+{
+    std::vector<file_stats> files;
+    qcn::stage_time dictionary;
+    qcn::stage_time compare;
+    qcn::stage_time output;
+    qcn::stage_time total;
+    uint64_t allocations;
+    uint64_t allocated;
+
+    run_stats() : allocations(0), allocated(0) {}
+};
+
+void PrintOutput(
+    qcn::ReportWriter& o,
+    qcn::diff_ref_type const& d, 
+    std::string const& fileone,
+    std::string const& filetwo,
+    qcn::NvTable const* dict,
+    printformat p = interleave
+);
+
+void PrintCsvHeader(qcn::ReportWriter& o);
+
+void PrintRecord(
+    qcn::ReportWriter& o,
+    qcn::qref const& r,
+    std::string const& fileone,
+    std::string const& filetwo,
+    qcn::NvTable const* dict,
+    printformat const p
+);
+
+std::vector<qcn::uint> DescribedCodes(qcn::diff_ref_type const& d);
+
+void AddSummary(
+    summary_type& summary,
+    qcn::qref const& r,
+    std::size_t const file,
+    std::size_t const files
+);
+
+void AddSummary(
+    summary_type& summary,
+    qcn::diff_ref_type const& d,
+    std::size_t const file,
+    std::size_t const files
+);
+
+void PrintSummary(
+    qcn::ReportWriter& o,
+    summary_type const& summary,
+    files_type const& names,
+    files_type const& errors,
+    qcn::NvTable const* dict
+);
+
+void PrintStats(std::ostream& o, run_stats const& s, bool const json);
+
+#endif
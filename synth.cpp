@@ -0,0 +1,223 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#include <map>
+#include "synth.hpp"
+
+namespace qcn
+{
+    namespace
+    {
+        char const* const statuses[] = {
+            "OK", "Inactive item", "Parameter bad", "Access denied"
+        };
+
+        // SplitMix64, so that every value depends only on the seed and the
+        // position it is drawn for
+
+        uint64_t const Mix(uint64_t x)
+        {
+            x += 0x9e3779b97f4a7c15ULL;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        inline uint64_t const Draw(uint64_t const seed, uint64_t const a, uint64_t const b = 0)
+        {
+            return Mix(seed ^ Mix(a ^ Mix(b)));
+        }
+
+        inline double const Uniform(uint64_t const r)
+        {
+            return (r >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // An item on its way out: its status is an index into statuses
+
+        struct item
+        {
+            uint code;
+            uint status;
+            std::vector<uint8_t> data;
+        };
+
+        // Change the item as the variant says, giving an item that gains 
+        // data a zero payload of size bytes. Returns false if the item is
+        // to be left out
+
+        bool const Change(synth_options const& s, item& q, uint const size)
+        {
+            uint64_t const r = Draw(s.variant, q.code);
+            if (!s.variant || Uniform(r) >= s.mutation) return true;
+
+            switch (r % 8)
+            {
+                case 0:
+                    return false;
+
+                case 1:
+                    // an item with data loses it, and one without gains it
+                
+                    if (q.status == 0) 
+                    {
+                        q.status = 1 + r % 3;
+                    }
+                    else 
+                    {
+                        q.status = 0;
+                        q.data.assign(size, 0);
+                    }
+                    return true;
+
+                default:
+                    for (uint i = 0; q.status == 0 && i < q.data.size() && i < 1 + r % 4; i++)
+                    {
+                        q.data[Draw(s.variant, q.code, i + 1) % q.data.size()] ^= 1 + i;
+                    }
+                    return true;
+            }
+        }
+
+        // Write an item in a section of items of size bytes. A payload of
+        // another size is written with its length
+
+        void Write(ReportWriter& w, item const& q, uint const size)
+        {
+            w.Decimal(q.code, 5) << " (0x";
+            w.Hex(q.code, 4) << ")   -   " << statuses[q.status];
+
+            if (q.status == 0 && q.data.size() != size)
+            {
+                w << " - ";
+                w.Decimal(q.data.size());
+            }
+            w << "\r\n";
+
+            for (std::size_t i = 0; q.status == 0 && i < q.data.size(); i++)
+            {
+                w.Byte(q.data[i]);
+                w << (i % 16 == 15 || i + 1 == q.data.size() ? "\r\n" : " ");
+            }
+            w << "\r\n";
+        }
+
+        void Header(ReportWriter& w, uint const complete, uint const size)
+        {
+            w << "[NV items]\r\n[Complete items - ";
+            w.Decimal(complete) << ", Items size - ";
+            w.Decimal(size) << "]\r\n\r\n";
+        }
+
+        // Items of a synthetic dump before any change
+
+        void Generate(synth_options const& s, uint const code, item& q)
+        {
+            uint64_t const r = Draw(s.seed, code);
+            double const total = s.mix[0] + s.mix[1] + s.mix[2] + s.mix[3];
+            double u = Uniform(r) * total;
+
+            q.code = code;
+            q.status = 0;
+            while (q.status < 3 && (u >= s.mix[q.status] || s.mix[q.status] <= 0))
+            {
+                u -= s.mix[q.status++];
+            }
+
+            // A few leading bytes are set, the rest are zero
+
+            q.data.assign(q.status == 0 ? s.size : 0, 0);
+            uint const used = std::min<uint>(q.data.size(), r >> 58);
+            for (uint i = 0; i < used; i++)
+            {
+                q.data[i] = Draw(s.seed, code, i + 1);
+            }
+        }
+    }
+
+    void Synthesize(std::ostream& o, synth_options const& s)
+    {
+        // The header counts the items with data, so the items are drawn 
+        // twice, first to count them
+
+        item q;
+        uint complete = 0;
+
+        for (uint code = 0; code < s.items; code++)
+        {
+            Generate(s, code, q);
+            if (Change(s, q, s.size) && q.status == 0) complete++;
+        }
+
+        ReportWriter w(o);
+        Header(w, complete, s.size);
+
+        for (uint code = 0; code < s.items; code++)
+        {
+            Generate(s, code, q);
+            if (Change(s, q, s.size)) Write(w, q, s.size);
+        }
+    }
+
+    void Mutate(std::ostream& o, Qcn const& base, synth_options const& s)
+    {
+        // The header gives the commonest payload size, and the items of 
+        // other sizes, as from other sections, give their own
+
+        std::map<uint, uint> sizes;
+        for (auto i = base.Sorted().begin(); i != base.Sorted().end(); ++i)
+        {
+            if ((*i)->status == status_ok) sizes[(*i)->data.size()]++;
+        }
+
+        uint size = 0;
+        uint most = 0;
+        for (auto i = sizes.begin(); i != sizes.end(); ++i)
+        {
+            if (i->second > most)
+            {
+                size = i->first;
+                most = i->second;
+            }
+        }
+
+        uint complete = 0;
+        item q;
+
+        auto load = [&q](qcn_item_type const& i) {
+            q.code = i.code;
+            q.status = i.status == status_missing ? 0 : i.status;
+            q.data.assign(i.data.begin(), i.data.end());
+        };
+
+        for (auto i = base.Sorted().begin(); i != base.Sorted().end(); ++i)
+        {
+            load(**i);
+            if (Change(s, q, size) && q.status == 0) complete++;
+        }
+
+        ReportWriter w(o);
+        Header(w, complete, size);
+
+        for (auto i = base.Sorted().begin(); i != base.Sorted().end(); ++i)
+        {
+            load(**i);
+            if (Change(s, q, size)) Write(w, q, size);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright 2014 dl12345@xda-developers forum
+
+*/
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <iostream>
+#include "qcn.hpp"
+
+namespace qcn
+{
+    // Shape of a synthetic dump in the QPST text layout. Items have codes
+    // from 0 and payloads of size bytes, mostly zero as in real dumps. The
+    // statuses are drawn in proportion to the weights in mix, in the order
+    // OK, Inactive item, Parameter bad, Access denied. The same seed always
+    // gives the same dump
+    //
+    // A variant other than 0 changes about mutation of the items: most get
+    // a few different bytes, some change status and some are left out
+
+    struct synth_options
+    {
+        uint items;
+        uint size;
+        double mix[4];
+        uint64_t seed;
+        uint64_t variant;
+        double mutation;
+
+        synth_options()
+            :   items(65536),
+                size(128),
+                seed(1),
+                variant(0),
+                mutation(0.01)
+        {
+            mix[0] = 1.0;
+            mix[1] = mix[2] = mix[3] = 0.0;
+        }
+    };
+
+    void Synthesize(std::ostream& o, synth_options const& s);
+
+    // Write the items of base in code order, changed as for a variant of 
+    // a synthetic dump, so that variant 0 writes the same items. Only the 
+    // variant and mutation of s are used
+
+    void Mutate(std::ostream& o, Qcn const& base, synth_options const& s);
+}
+
+#endif
@@ -0,0 +1,116 @@
+# Write a binary .qcn (OLE compound document) from a QPST text export,
+# holding its OK items of 128 bytes as QPST saves them. The binary test 
+# files were made with
+#
+#     mkqcn.py tst1.txt tst1.qcn
+#     mkqcn.py 906k.txt 906k.qcn
+#     mkqcn.py 906k.txt 906k.4k.qcn 12
+#     mkqcn.py 906s.txt 906s.shuffled.qcn 9 shuffle
+#
+# usage: mkqcn.py in.txt out.qcn [shift] [order]
+import sys, struct, re, random
+src, dst = sys.argv[1], sys.argv[2]
+shift = int(sys.argv[3]) if len(sys.argv) > 3 else 9
+order = sys.argv[4] if len(sys.argv) > 4 else 'file'
+SS = 1 << shift
+ENDC, FREE, FATSECT, DIFSECT = 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFD, 0xFFFFFFFC
+
+items = []
+cur = None
+for line in open(src, errors='replace'):
+    m = re.match(r'^(\d+)\s*\(0x[0-9A-Fa-f]+\)\s*-\s*(.*?)\s*$', line)
+    if m:
+        cur = [int(m.group(1)), m.group(2), bytearray()]
+        items.append(cur)
+        continue
+    if cur and re.match(r'^([0-9A-Fa-f]{2} )*[0-9A-Fa-f]{2}\s*$', line):
+        cur[2] += bytes.fromhex(line.strip())
+ok = [(c, d) for c, s, d in items if s.startswith('OK') and len(d) == 128]
+if order == 'shuffle':
+    random.Random(1).shuffle(ok)
+arr = b''.join(struct.pack('<HH', i % 7, c) + bytes(d) for i, (c, d) in enumerate(ok))
+
+# tree: root -> 00000000 -> default -> NV_NUMBERED_ITEMS -> NV_ITEM_ARRAY
+# with siblings to exercise the directory tree
+ents = []  # name, type, left, right, child, data
+def ent(name, typ, data=b''):
+    ents.append([name, typ, FREE, FREE, FREE, data]); return len(ents) - 1
+root = ent('Root Entry', 5)
+s0 = ent('00000000', 1)
+fv = ent('File_Version', 2, b'\x02\x00\x00\x00')
+dflt = ent('default', 1)
+mobile = ent('Mobile_Property_Info', 1)
+mp = ent('MOBILE_MODEL', 2, b'\x10\x00')
+nni = ent('NV_NUMBERED_ITEMS', 1)
+efs = ent('EFS_Backup', 1)
+arrs = ent('NV_ITEM_ARRAY', 2, arr)
+other = ent('NV_ITEM_ARRAY_SIM_1', 2, b'')
+feat = ent('Feature_Mask', 2, b'\x00' * 5000)
+ents[root][4] = s0
+ents[s0][4] = dflt; ents[dflt][2] = fv; ents[dflt][3] = mobile
+ents[mobile][4] = mp
+ents[dflt][4] = nni; ents[nni][2] = efs; ents[nni][3] = feat
+ents[nni][4] = other; ents[other][2] = arrs
+
+sectors = []  # list of bytes of size SS
+fat = {}
+def alloc(data):
+    n = (len(data) + SS - 1) // SS
+    if n == 0: return ENDC
+    first = len(sectors)
+    for i in range(n):
+        sectors.append(data[i*SS:(i+1)*SS].ljust(SS, b'\0'))
+        fat[first + i] = first + i + 1 if i < n - 1 else ENDC
+    return first
+
+mini = bytearray(); minifat = []
+starts = {}
+for i, e in enumerate(ents):
+    if e[1] == 2 and 0 < len(e[5]) < 4096:
+        n = (len(e[5]) + 63) // 64
+        first = len(mini) // 64
+        mini += e[5].ljust(n * 64, b'\0')
+        for k in range(n): minifat.append(first + k + 1 if k < n - 1 else ENDC)
+        starts[i] = first
+for i, e in enumerate(ents):
+    if e[1] == 2 and len(e[5]) >= 4096:
+        starts[i] = alloc(e[5])
+    elif e[1] == 2 and len(e[5]) == 0:
+        starts[i] = ENDC
+starts[root] = alloc(bytes(mini))
+ents[root][5] = bytes(mini)
+mfstart = alloc(b''.join(struct.pack('<I', x) for x in minifat)) if minifat else ENDC
+nmf = (len(minifat) * 4 + SS - 1) // SS
+d = b''
+for i, e in enumerate(ents):
+    nm = e[0].encode('utf-16-le') + b'\0\0'
+    d += nm.ljust(64, b'\0') + struct.pack('<HBBIII', len(nm), e[1], 1, e[2], e[3], e[4]) + b'\0' * 16 + b'\0' * 4 + b'\0' * 16 + struct.pack('<IQ', starts.get(i, ENDC) if e[1] != 1 else 0, len(e[5]) if e[1] != 1 else 0)
+while len(d) % SS: d += (b'\0' * 64).ljust(64, b'\0') + struct.pack('<HBBIII', 0, 0, 0, FREE, FREE, FREE) + b'\0' * 52
+dirstart = alloc(d)
+# FAT sectors (with DIFAT chain if needed)
+per = SS // 4
+nfat = 1
+while True:
+    total = len(sectors) + nfat + max(0, -(-(nfat - 109) // (per - 1)))
+    if nfat * per >= total: break
+    nfat += 1
+ndif = max(0, -(-(nfat - 109) // (per - 1)))
+fatsecs = list(range(len(sectors), len(sectors) + nfat))
+difsecs = list(range(len(sectors) + nfat, len(sectors) + nfat + ndif))
+for s in fatsecs: fat[s] = FATSECT
+for s in difsecs: fat[s] = DIFSECT
+table = [fat.get(i, FREE) for i in range(nfat * per)]
+for k in range(nfat):
+    sectors.append(b''.join(struct.pack('<I', x) for x in table[k*per:(k+1)*per]))
+rest = fatsecs[109:]
+for k, s in enumerate(difsecs):
+    chunk = rest[k*(per-1):(k+1)*(per-1)]
+    chunk += [FREE] * (per - 1 - len(chunk))
+    nxt = difsecs[k+1] if k + 1 < len(difsecs) else ENDC
+    sectors.append(b''.join(struct.pack('<I', x) for x in chunk + [nxt]))
+hdr = bytes.fromhex('D0CF11E0A1B11AE1') + b'\0' * 16 + struct.pack('<HHHHH', 0x3E, 3 if shift == 9 else 4, 0xFFFE, shift, 6)
+hdr += b'\0' * 6 + struct.pack('<IIIIIIIII', 0 if shift == 9 else len(sectors), nfat, dirstart, 0, 4096, mfstart, nmf, difsecs[0] if difsecs else ENDC, ndif)
+hdr += b''.join(struct.pack('<I', x) for x in (fatsecs[:109] + [FREE] * 109)[:109])
+assert len(hdr) == 512
+open(dst, 'wb').write(hdr.ljust(SS, b'\0') + b''.join(sectors))
+print(len(ok), 'items', len(arr), 'bytes', nfat, 'fat', ndif, 'difat')